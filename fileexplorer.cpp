@@ -6,59 +6,5680 @@
 #include <unistd.h>
 #include <cstring>
 #include <algorithm>
+#include <iterator>
 #include <fstream>
 #include <pwd.h>
 #include <grp.h>
 #include <time.h>
 #include <iomanip>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <cstddef>
+#include <cerrno>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <set>
+#include <regex>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <sys/sysmacros.h>
+#include <sys/mman.h>
+#include <cstdint>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <climits>
+#include <sstream>
+#include <cctype>
+#include <fnmatch.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define FILE_EXPLORER_HAVE_IO_URING 1
+#endif
+#endif
 
 using namespace std;
 
-// Color codes for better UI
-#define RESET   "\033[0m"
-#define RED     "\033[31m"
-#define GREEN   "\033[32m"
-#define YELLOW  "\033[33m"
-#define BLUE    "\033[34m"
-#define MAGENTA "\033[35m"
-#define CYAN    "\033[36m"
-#define WHITE   "\033[37m"
-#define BOLD    "\033[1m"
+// Whether stdout is a terminal: -1 until checked, again after stdout has
+// been redirected (see refreshStdoutColors)
+static atomic<int> stdoutColorState(-1);
+
+// Helper function deciding whether color codes go to stdout
+static inline bool stdoutColors() {
+    int state = stdoutColorState.load(memory_order_relaxed);
+    if (state < 0) {
+        state = isatty(STDOUT_FILENO) == 1 ? 1 : 0;
+        stdoutColorState.store(state, memory_order_relaxed);
+    }
+    return state == 1;
+}
+
+// Helper function to call after dup2() onto stdout
+static inline void refreshStdoutColors() {
+    stdoutColorState.store(-1, memory_order_relaxed);
+}
+
+// Color codes for better UI; empty when stdout is not a terminal
+#define COLOR_CODE(code) (stdoutColors() ? (code) : "")
+#define RESET   COLOR_CODE("\033[0m")
+#define RED     COLOR_CODE("\033[31m")
+#define GREEN   COLOR_CODE("\033[32m")
+#define YELLOW  COLOR_CODE("\033[33m")
+#define BLUE    COLOR_CODE("\033[34m")
+#define MAGENTA COLOR_CODE("\033[35m")
+#define CYAN    COLOR_CODE("\033[36m")
+#define WHITE   COLOR_CODE("\033[37m")
+#define BOLD    COLOR_CODE("\033[1m")
+
+// Phases timed by the built-in instrumentation. Times are inclusive: a
+// copy that runs inside a move counts towards both.
+enum ProfilePhase {
+    PHASE_READDIR, PHASE_STAT, PHASE_NAME_LOOKUP, PHASE_SORT, PHASE_RENDER,
+    PHASE_COPY, PHASE_DELETE, PHASE_MOVE, PHASE_SEARCH, PHASE_DISK_USAGE, PHASE_BATCH,
+    PHASE_COUNT
+};
+
+// Event counters kept next to the phase timers
+enum ProfileCounter {
+    COUNTER_GETDENTS_CALLS, COUNTER_DIRENT_BYTES, COUNTER_STAT_CALLS, COUNTER_NSS_LOOKUPS,
+    COUNTER_COPY_BYTES, COUNTER_UNLINK_CALLS, COUNTER_OUTPUT_WRITES, COUNTER_OUTPUT_BYTES,
+    COUNTER_COUNT
+};
+
+// Process-wide hot-path instrumentation: call counts and time per phase,
+// event counters, and optionally a timeline of phase spans that loads in
+// chrome://tracing or Perfetto. It is off by default, and then every probe
+// costs one relaxed atomic load.
+class Profiler {
+public:
+    static const size_t MAX_TRACE_EVENTS = 1000000;
+
+    struct TraceEvent {
+        ProfilePhase phase;
+        long threadId;
+        uint64_t startNs;
+        uint64_t durationNs;
+    };
+
+private:
+    atomic<bool> enabled;
+    atomic<bool> tracing;
+    atomic<uint64_t> phaseCalls[PHASE_COUNT];
+    atomic<uint64_t> phaseNanos[PHASE_COUNT];
+    atomic<uint64_t> counters[COUNTER_COUNT];
+    mutex traceMutex;
+    vector<TraceEvent> trace;    // guarded by traceMutex
+    uint64_t droppedEvents;      // guarded by traceMutex
+    uint64_t traceStartNs;
+
+    Profiler() : enabled(false), tracing(false), droppedEvents(0), traceStartNs(0) {
+        reset();
+    }
+
+public:
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    static const char* phaseName(ProfilePhase phase) {
+        static const char* const names[PHASE_COUNT] = {
+            "readdir", "stat", "name lookup", "sort", "render",
+            "copy", "delete", "move", "search", "disk usage", "batch"
+        };
+        return names[phase];
+    }
+
+    static const char* counterName(ProfileCounter counter) {
+        static const char* const names[COUNTER_COUNT] = {
+            "getdents64 calls", "dirent bytes", "stat calls", "NSS lookups",
+            "bytes copied", "unlink calls", "output writes", "output bytes"
+        };
+        return names[counter];
+    }
+
+    static uint64_t nowNs() {
+        return chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool isEnabled() const {
+        return enabled.load(memory_order_relaxed);
+    }
+
+    bool isTracing() const {
+        return tracing.load(memory_order_relaxed);
+    }
+
+    void setEnabled(bool on) {
+        if (!on) tracing.store(false, memory_order_relaxed);
+        enabled.store(on, memory_order_relaxed);
+    }
+
+    // Recording a timeline implies collecting the aggregates too
+    void setTracing(bool on) {
+        if (on) {
+            lock_guard<mutex> lock(traceMutex);
+            if (trace.empty()) traceStartNs = nowNs();
+            enabled.store(true, memory_order_relaxed);
+        }
+        tracing.store(on, memory_order_relaxed);
+    }
+
+    void count(ProfileCounter counter, uint64_t amount = 1) {
+        if (!isEnabled()) return;
+        counters[counter].fetch_add(amount, memory_order_relaxed);
+    }
+
+    void record(ProfilePhase phase, uint64_t startNs, uint64_t endNs) {
+        phaseCalls[phase].fetch_add(1, memory_order_relaxed);
+        phaseNanos[phase].fetch_add(endNs - startNs, memory_order_relaxed);
+        if (!isTracing()) return;
+
+        static thread_local long threadId = syscall(SYS_gettid);
+        TraceEvent event = {phase, threadId, startNs, endNs - startNs};
+        lock_guard<mutex> lock(traceMutex);
+        if (trace.size() < MAX_TRACE_EVENTS) {
+            trace.push_back(event);
+        } else {
+            droppedEvents++;
+        }
+    }
+
+    uint64_t phaseCallCount(ProfilePhase phase) const {
+        return phaseCalls[phase].load(memory_order_relaxed);
+    }
+
+    uint64_t phaseNanoseconds(ProfilePhase phase) const {
+        return phaseNanos[phase].load(memory_order_relaxed);
+    }
+
+    uint64_t counterValue(ProfileCounter counter) const {
+        return counters[counter].load(memory_order_relaxed);
+    }
+
+    size_t traceEventCount() {
+        lock_guard<mutex> lock(traceMutex);
+        return trace.size();
+    }
+
+    uint64_t droppedTraceEvents() {
+        lock_guard<mutex> lock(traceMutex);
+        return droppedEvents;
+    }
+
+    void reset() {
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            phaseCalls[i].store(0, memory_order_relaxed);
+            phaseNanos[i].store(0, memory_order_relaxed);
+        }
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            counters[i].store(0, memory_order_relaxed);
+        }
+        lock_guard<mutex> lock(traceMutex);
+        trace.clear();
+        droppedEvents = 0;
+        traceStartNs = nowNs();
+    }
+
+    // Writes the recorded spans in the Chrome trace event format ("X"
+    // complete events, microsecond timestamps from the start of tracing)
+    bool writeChromeTrace(const string& path, string& error) {
+        FILE* file = fopen(path.c_str(), "w");
+        if (file == NULL) {
+            error = strerror(errno);
+            return false;
+        }
+        lock_guard<mutex> lock(traceMutex);
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        long pid = getpid();
+        for (size_t i = 0; i < trace.size(); i++) {
+            const TraceEvent& event = trace[i];
+            uint64_t start = event.startNs >= traceStartNs ? event.startNs - traceStartNs : 0;
+            fprintf(file, "{\"name\":\"%s\",\"cat\":\"file_explorer\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                          "\"pid\":%ld,\"tid\":%ld}%s\n",
+                    phaseName(event.phase), start / 1000.0, event.durationNs / 1000.0, pid, event.threadId,
+                    i + 1 < trace.size() ? "," : "");
+        }
+        fprintf(file, "]}\n");
+        if (fclose(file) != 0) {
+            error = strerror(errno);
+            return false;
+        }
+        return true;
+    }
+};
+
+// Helper class that times the enclosing block as one span of 'phase'
+class ScopedPhase {
+private:
+    ProfilePhase phase;
+    uint64_t startNs;  // 0 when instrumentation was off at entry
+
+public:
+    explicit ScopedPhase(ProfilePhase timedPhase)
+        : phase(timedPhase), startNs(Profiler::instance().isEnabled() ? Profiler::nowNs() : 0) {}
+
+    ~ScopedPhase() {
+        if (startNs != 0) {
+            Profiler::instance().record(phase, startNs, Profiler::nowNs());
+        }
+    }
+};
+
+// Helper function for every stat-family call, so the profiler's stat
+// counter sees them all: stat() is (AT_FDCWD, path, st, 0), lstat() adds
+// AT_SYMLINK_NOFOLLOW and fstat() is (fd, "", st, AT_EMPTY_PATH)
+static inline int countedStat(int dirFd, const char* path, struct stat* st, int flags) {
+    Profiler::instance().count(COUNTER_STAT_CALLS);
+    return fstatat(dirFd, path, st, flags);
+}
+
+// Record layout returned by getdents64(2); glibc does not export it
+struct LinuxDirent64 {
+    ino64_t        d_ino;
+    off64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[1];
+};
+
+// Helper class to read raw directory entries in large getdents64 batches
+class DirReader {
+private:
+    static const size_t BUFFER_SIZE = 256 * 1024;
+    int fd;
+    vector<char> buffer;
+    size_t pos;
+    size_t len;
+    int lastError;
+    off64_t lastOffset;
+
+public:
+    explicit DirReader(int dirFd)
+        : fd(dirFd), buffer(BUFFER_SIZE), pos(0), len(0), lastError(0), lastOffset(0) {}
+
+    // Returns the next entry, or false at the end of the directory or on error.
+    // The name pointer stays valid until the following call.
+    bool next(const char*& name, unsigned char& type) {
+        while (pos >= len) {
+            long n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            Profiler::instance().count(COUNTER_GETDENTS_CALLS);
+            if (n <= 0) {
+                lastError = (n < 0) ? errno : 0;
+                return false;
+            }
+            pos = 0;
+            len = static_cast<size_t>(n);
+            Profiler::instance().count(COUNTER_DIRENT_BYTES, len);
+        }
+        const char* record = buffer.data() + pos;
+        const LinuxDirent64* dirent = reinterpret_cast<const LinuxDirent64*>(record);
+        pos += dirent->d_reclen;
+        name = record + offsetof(LinuxDirent64, d_name);
+        type = dirent->d_type;
+        lastOffset = dirent->d_off;
+        return true;
+    }
+
+    // Directory cookie just past the last returned entry; seek() to it
+    // later to resume reading from the following entry
+    off64_t position() const {
+        return lastOffset;
+    }
+
+    bool seek(off64_t offset) {
+        if (lseek64(fd, offset, SEEK_SET) < 0) {
+            lastError = errno;
+            return false;
+        }
+        pos = len = 0;
+        lastError = 0;
+        lastOffset = offset;
+        return true;
+    }
+
+    int error() const {
+        return lastError;
+    }
+};
+
+// Helper function to recognise the "." and ".." entries
+static inline bool isDotOrDotDot(const char* name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// Helper class reading one directory of a tree walk: the directory is
+// opened without following symlinks, "." and ".." are skipped, and entries
+// whose d_type is DT_UNKNOWN get their type from an lstat relative to the
+// directory fd. That lstat is kept, so entryStat() does not repeat it.
+class TreeDirectory {
+private:
+    int dirFd;
+    int openErrno;
+    DirReader reader;
+    const char* currentName;
+    struct stat currentStat;
+    int statErrno;      // 0 when currentStat is valid
+    bool statDone;
+
+    static int openDirectory(const string& path) {
+        return open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+
+public:
+    explicit TreeDirectory(const string& path)
+        : dirFd(openDirectory(path)), openErrno(dirFd < 0 ? errno : 0), reader(dirFd),
+          currentName(NULL), statErrno(0), statDone(false) {}
+
+    ~TreeDirectory() {
+        if (dirFd >= 0) close(dirFd);
+    }
+
+    bool isOpen() const { return dirFd >= 0; }
+    int openError() const { return openErrno; }
+    int readError() const { return reader.error(); }
+    int fd() const { return dirFd; }
+
+    // Next entry, or false at the end or on a read error. 'type' stays
+    // DT_UNKNOWN only when the lstat resolving it failed (see statError)
+    bool next(const char*& name, unsigned char& type) {
+        if (dirFd < 0) return false;
+        do {
+            if (!reader.next(name, type)) return false;
+        } while (isDotOrDotDot(name));
+        currentName = name;
+        statDone = false;
+        if (type == DT_UNKNOWN) {
+            const struct stat* st = entryStat();
+            if (st != NULL) type = IFTODT(st->st_mode);
+        }
+        return true;
+    }
+
+    // lstat of the current entry, or NULL (see statError)
+    const struct stat* entryStat() {
+        if (!statDone) {
+            statDone = true;
+            statErrno = countedStat(dirFd, currentName, &currentStat, AT_SYMLINK_NOFOLLOW) == 0 ? 0 : errno;
+        }
+        return statErrno == 0 ? &currentStat : NULL;
+    }
+
+    int statError() const { return statErrno; }
+};
+
+// Helper class owning a fixed set of worker threads. Each worker has its
+// own task deque: it pops its newest task, and when idle steals the oldest
+// task of another worker. Tasks submitted from a worker stay on that
+// worker's deque, so nested work (e.g. subdirectories) is handled locally.
+class WorkerPool {
+public:
+    // Tracks a set of submitted tasks so their submitter can wait for them
+    class TaskGroup {
+        friend class WorkerPool;
+        size_t outstanding;
+        mutex groupMutex;
+        condition_variable finished;
+
+    public:
+        TaskGroup() : outstanding(0) {}
+    };
+
+private:
+    struct WorkerQueue {
+        mutex queueMutex;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> workers;
+    mutex sleepMutex;
+    condition_variable wakeUp;
+    atomic<size_t> queuedTasks;
+    atomic<size_t> nextQueue;
+    bool stopping;
+
+    static thread_local WorkerPool* currentPool;
+    static thread_local size_t currentWorker;
+
+    // Helper function to run one queued task: own deque first, then steal
+    bool runOne() {
+        size_t count = queues.size();
+        size_t self = (currentPool == this) ? currentWorker : nextQueue.load() % count;
+        function<void()> task;
+        for (size_t i = 0; i < count && !task; i++) {
+            WorkerQueue& queue = *queues[(self + i) % count];
+            lock_guard<mutex> lock(queue.queueMutex);
+            if (queue.tasks.empty()) continue;
+            if (i == 0 && currentPool == this) {
+                task = move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+        if (!task) return false;
+        queuedTasks--;
+        task();
+        return true;
+    }
+
+    void workerLoop(size_t index) {
+        currentPool = this;
+        currentWorker = index;
+        for (;;) {
+            if (runOne()) continue;
+            unique_lock<mutex> lock(sleepMutex);
+            wakeUp.wait(lock, [this] { return stopping || queuedTasks.load() > 0; });
+            if (stopping && queuedTasks.load() == 0) return;
+        }
+    }
+
+    void push(function<void()> task) {
+        size_t index = (currentPool == this) ? currentWorker : nextQueue++ % queues.size();
+        {
+            lock_guard<mutex> lock(queues[index]->queueMutex);
+            queues[index]->tasks.push_back(move(task));
+        }
+        queuedTasks++;
+        lock_guard<mutex> lock(sleepMutex);
+        wakeUp.notify_one();
+    }
+
+public:
+    explicit WorkerPool(unsigned threadCount) : queuedTasks(0), nextQueue(0), stopping(false) {
+        if (threadCount == 0) threadCount = 1;
+        for (unsigned i = 0; i < threadCount; i++) {
+            queues.push_back(unique_ptr<WorkerQueue>(new WorkerQueue()));
+        }
+        for (unsigned i = 0; i < threadCount; i++) {
+            workers.push_back(thread(&WorkerPool::workerLoop, this, static_cast<size_t>(i)));
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    unsigned size() const {
+        return static_cast<unsigned>(workers.size());
+    }
+
+    // Number of tasks submitted but not yet started
+    size_t pending() const {
+        return queuedTasks.load();
+    }
+
+    // Queue 'task' as part of 'group'
+    void submit(TaskGroup& group, function<void()> task) {
+        {
+            lock_guard<mutex> lock(group.groupMutex);
+            group.outstanding++;
+        }
+        push([&group, task]() mutable {
+            task();
+            // Release whatever the task captured before the group can be
+            // seen as finished
+            task = nullptr;
+            lock_guard<mutex> lock(group.groupMutex);
+            if (--group.outstanding == 0) group.finished.notify_all();
+        });
+    }
+
+    // Run one queued task on the calling thread, if there is one. Used by
+    // producers to throttle themselves when the queues grow too long.
+    bool helpOne() {
+        return runOne();
+    }
+
+    // Block until every task of 'group' has finished, running queued tasks
+    // meanwhile so that waiting inside a task cannot deadlock the pool
+    void wait(TaskGroup& group) {
+        for (;;) {
+            {
+                unique_lock<mutex> lock(group.groupMutex);
+                if (group.outstanding == 0) return;
+            }
+            if (runOne()) continue;
+            unique_lock<mutex> lock(group.groupMutex);
+            group.finished.wait_for(lock, chrono::milliseconds(1),
+                                    [&group] { return group.outstanding == 0; });
+        }
+    }
+
+    // Runs fn(i) for every i in [0, count). Indices are handed out in small
+    // chunks; the calling thread takes part and the call returns once every
+    // index has been processed.
+    void parallelFor(size_t count, const function<void(size_t)>& fn, size_t chunk = 64) {
+        if (count == 0) return;
+        atomic<size_t> nextIndex(0);
+        auto drain = [&]() {
+            for (;;) {
+                size_t begin = nextIndex.fetch_add(chunk);
+                if (begin >= count) return;
+                size_t end = min(count, begin + chunk);
+                for (size_t i = begin; i < end; i++) fn(i);
+            }
+        };
+
+        TaskGroup group;
+        size_t helpers = min<size_t>(workers.size(), (count + chunk - 1) / chunk);
+        for (size_t i = 0; i < helpers; i++) {
+            submit(group, drain);
+        }
+        drain();
+        wait(group);
+    }
+};
+
+thread_local WorkerPool* WorkerPool::currentPool = NULL;
+thread_local size_t WorkerPool::currentWorker = 0;
+
+// Helper class for a bounded LRU cache whose entries expire after a TTL.
+// Not thread-safe on its own; callers hold their own lock.
+template <typename Key, typename Value>
+class LruTtlCache {
+private:
+    struct Slot {
+        Value value;
+        time_t expires;
+        typename list<Key>::iterator lruPos;
+    };
+    unordered_map<Key, Slot> slots;
+    list<Key> lru;  // most recently used at the front
+    size_t capacity;
+
+public:
+    explicit LruTtlCache(size_t maxEntries) : capacity(maxEntries) {}
+
+    bool get(const Key& key, time_t now, Value& value) {
+        auto it = slots.find(key);
+        if (it == slots.end()) return false;
+        if (it->second.expires <= now) {
+            lru.erase(it->second.lruPos);
+            slots.erase(it);
+            return false;
+        }
+        lru.splice(lru.begin(), lru, it->second.lruPos);
+        value = it->second.value;
+        return true;
+    }
+
+    void put(const Key& key, const Value& value, time_t expires) {
+        auto it = slots.find(key);
+        if (it != slots.end()) {
+            it->second.value = value;
+            it->second.expires = expires;
+            lru.splice(lru.begin(), lru, it->second.lruPos);
+            return;
+        }
+        while (!lru.empty() && slots.size() >= capacity) {
+            slots.erase(lru.back());
+            lru.pop_back();
+        }
+        if (capacity == 0) return;
+        lru.push_front(key);
+        Slot slot;
+        slot.value = value;
+        slot.expires = expires;
+        slot.lruPos = lru.begin();
+        slots.insert(make_pair(key, slot));
+    }
+
+    void setCapacity(size_t maxEntries) {
+        capacity = maxEntries;
+        while (slots.size() > capacity) {
+            slots.erase(lru.back());
+            lru.pop_back();
+        }
+    }
+
+    void clear() {
+        slots.clear();
+        lru.clear();
+    }
+
+    size_t size() const {
+        return slots.size();
+    }
+};
+
+// Process-wide uid/gid <-> name cache. With NSS backed by LDAP or similar,
+// getpwuid()/getgrgid() are expensive and return the same few names for
+// thousands of rows. Failed lookups are cached too.
+class IdNameCache {
+private:
+    struct IdResult {
+        unsigned long id;
+        bool found;
+    };
+
+    mutable mutex cacheMutex;
+    LruTtlCache<unsigned long, string> userNames;
+    LruTtlCache<unsigned long, string> groupNames;
+    LruTtlCache<string, IdResult> userIds;
+    LruTtlCache<string, IdResult> groupIds;
+    int ttlSeconds;
+    atomic<unsigned long> hitCount;
+    atomic<unsigned long> missCount;
+
+    IdNameCache()
+        : userNames(DEFAULT_CAPACITY), groupNames(DEFAULT_CAPACITY),
+          userIds(DEFAULT_CAPACITY), groupIds(DEFAULT_CAPACITY),
+          ttlSeconds(DEFAULT_TTL), hitCount(0), missCount(0) {}
+
+    // Helper function to size the scratch buffer for the *_r lookups
+    static size_t lookupBufferSize(int name) {
+        long size = sysconf(name);
+        return size > 0 ? static_cast<size_t>(size) : 16384;
+    }
+
+    // Helper function to run one getpw*_r/getgr*_r call through 'lookup',
+    // doubling the scratch buffer while the entry does not fit (ERANGE).
+    // Returns the call's error number: 0 also when there is no entry.
+    template <typename Lookup>
+    static int lookupGrowing(int sizeName, const Lookup& lookup) {
+        vector<char> buffer(lookupBufferSize(sizeName));
+        for (;;) {
+            int error = lookup(buffer);
+            if (error != ERANGE || buffer.size() >= MAX_LOOKUP_BUFFER) return error;
+            buffer.resize(buffer.size() * 2);
+        }
+    }
+
+public:
+    static const size_t DEFAULT_CAPACITY = 4096;
+    static const int DEFAULT_TTL = 300;
+    static const size_t MAX_LOOKUP_BUFFER = 1024 * 1024;
+
+    static IdNameCache& instance() {
+        static IdNameCache cache;
+        return cache;
+    }
+
+    // Name for a uid, or the number itself when there is no passwd entry
+    string userName(uid_t uid) {
+        time_t now = time(NULL);
+        string name;
+        {
+            lock_guard<mutex> lock(cacheMutex);
+            if (userNames.get(uid, now, name)) {
+                hitCount++;
+                return name;
+            }
+        }
+        missCount++;
+
+        bool found = false;
+        int error;
+        {
+            ScopedPhase timer(PHASE_NAME_LOOKUP);
+            Profiler::instance().count(COUNTER_NSS_LOOKUPS);
+            error = lookupGrowing(_SC_GETPW_R_SIZE_MAX, [&](vector<char>& buffer) {
+                struct passwd pwd;
+                struct passwd* result = NULL;
+                int rc = getpwuid_r(uid, &pwd, buffer.data(), buffer.size(), &result);
+                if (rc == 0 && result != NULL) {
+                    name = result->pw_name;
+                    found = true;
+                }
+                return rc;
+            });
+        }
+        if (!found) name = to_string(uid);
+        // A failed lookup is not a missing entry; ask again next time
+        if (error != 0) return name;
+
+        lock_guard<mutex> lock(cacheMutex);
+        userNames.put(uid, name, now + ttlSeconds);
+        return name;
+    }
+
+    // Name for a gid, or the number itself when there is no group entry
+    string groupName(gid_t gid) {
+        time_t now = time(NULL);
+        string name;
+        {
+            lock_guard<mutex> lock(cacheMutex);
+            if (groupNames.get(gid, now, name)) {
+                hitCount++;
+                return name;
+            }
+        }
+        missCount++;
+
+        bool found = false;
+        int error;
+        {
+            ScopedPhase timer(PHASE_NAME_LOOKUP);
+            Profiler::instance().count(COUNTER_NSS_LOOKUPS);
+            error = lookupGrowing(_SC_GETGR_R_SIZE_MAX, [&](vector<char>& buffer) {
+                struct group grp;
+                struct group* result = NULL;
+                int rc = getgrgid_r(gid, &grp, buffer.data(), buffer.size(), &result);
+                if (rc == 0 && result != NULL) {
+                    name = result->gr_name;
+                    found = true;
+                }
+                return rc;
+            });
+        }
+        if (!found) name = to_string(gid);
+        if (error != 0) return name;
+
+        lock_guard<mutex> lock(cacheMutex);
+        groupNames.put(gid, name, now + ttlSeconds);
+        return name;
+    }
+
+    // Reverse lookup used when changing ownership by name
+    bool userId(const string& name, uid_t& uid) {
+        time_t now = time(NULL);
+        IdResult cached;
+        {
+            lock_guard<mutex> lock(cacheMutex);
+            if (userIds.get(name, now, cached)) {
+                hitCount++;
+                uid = static_cast<uid_t>(cached.id);
+                return cached.found;
+            }
+        }
+        missCount++;
+
+        cached.found = false;
+        cached.id = 0;
+        int error = lookupGrowing(_SC_GETPW_R_SIZE_MAX, [&](vector<char>& buffer) {
+            struct passwd pwd;
+            struct passwd* result = NULL;
+            int rc = getpwnam_r(name.c_str(), &pwd, buffer.data(), buffer.size(), &result);
+            if (rc == 0 && result != NULL) {
+                cached.found = true;
+                cached.id = result->pw_uid;
+            }
+            return rc;
+        });
+        uid = static_cast<uid_t>(cached.id);
+        if (error != 0) return false;
+
+        lock_guard<mutex> lock(cacheMutex);
+        userIds.put(name, cached, now + ttlSeconds);
+        uid = static_cast<uid_t>(cached.id);
+        return cached.found;
+    }
+
+    // Reverse lookup used when changing group ownership by name
+    bool groupId(const string& name, gid_t& gid) {
+        time_t now = time(NULL);
+        IdResult cached;
+        {
+            lock_guard<mutex> lock(cacheMutex);
+            if (groupIds.get(name, now, cached)) {
+                hitCount++;
+                gid = static_cast<gid_t>(cached.id);
+                return cached.found;
+            }
+        }
+        missCount++;
+
+        cached.found = false;
+        cached.id = 0;
+        int error = lookupGrowing(_SC_GETGR_R_SIZE_MAX, [&](vector<char>& buffer) {
+            struct group grp;
+            struct group* result = NULL;
+            int rc = getgrnam_r(name.c_str(), &grp, buffer.data(), buffer.size(), &result);
+            if (rc == 0 && result != NULL) {
+                cached.found = true;
+                cached.id = result->gr_gid;
+            }
+            return rc;
+        });
+        gid = static_cast<gid_t>(cached.id);
+        if (error != 0) return false;
+
+        lock_guard<mutex> lock(cacheMutex);
+        groupIds.put(name, cached, now + ttlSeconds);
+        gid = static_cast<gid_t>(cached.id);
+        return cached.found;
+    }
+
+    // Set the per-table entry limit and the TTL; existing entries keep
+    // their old expiry time
+    void configure(size_t maxEntries, int ttl) {
+        lock_guard<mutex> lock(cacheMutex);
+        userNames.setCapacity(maxEntries);
+        groupNames.setCapacity(maxEntries);
+        userIds.setCapacity(maxEntries);
+        groupIds.setCapacity(maxEntries);
+        ttlSeconds = ttl;
+    }
+
+    // Forget everything, e.g. after editing /etc/passwd
+    void clear() {
+        lock_guard<mutex> lock(cacheMutex);
+        userNames.clear();
+        groupNames.clear();
+        userIds.clear();
+        groupIds.clear();
+    }
+
+    unsigned long hits() const {
+        return hitCount.load();
+    }
+
+    unsigned long misses() const {
+        return missCount.load();
+    }
+
+    size_t size() const {
+        lock_guard<mutex> lock(cacheMutex);
+        return userNames.size() + groupNames.size() + userIds.size() + groupIds.size();
+    }
+};
+
+// Compact snapshot of one directory. All names live back to back (NUL
+// terminated) in a single arena and each entry is a fixed-size record
+// pointing into it, so a listing costs two growing buffers instead of a
+// heap string per name. Sorting and filtering permute the 'order' index
+// vector; records and names never move once added.
+class DirSnapshot {
+public:
+    struct Entry {
+        int64_t size;
+        int64_t mtime;
+        uint32_t nameOffset;
+        uint32_t mode;
+        uint32_t uid;
+        uint32_t gid;
+        uint16_t nameLength;
+        unsigned char type;     // DT_* value from the dirent, or derived from mode
+        bool hasStat;
+    };
+
+private:
+    vector<char> arena;
+    vector<Entry> records;
+    vector<uint32_t> view;
+
+public:
+    void clear() {
+        arena.clear();
+        records.clear();
+        view.clear();
+    }
+
+    void reserve(size_t entries, size_t nameBytes) {
+        records.reserve(entries);
+        view.reserve(entries);
+        arena.reserve(nameBytes);
+    }
+
+    // Appends an entry without stat data; returns its record index
+    size_t add(const char* name, size_t length, unsigned char type) {
+        Entry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.nameOffset = static_cast<uint32_t>(arena.size());
+        entry.nameLength = static_cast<uint16_t>(length);
+        entry.type = type;
+        entry.hasStat = false;
+        arena.insert(arena.end(), name, name + length + 1);
+        records.push_back(entry);
+        view.push_back(static_cast<uint32_t>(records.size() - 1));
+        return records.size() - 1;
+    }
+
+    size_t add(const char* name, unsigned char type) {
+        return add(name, strlen(name), type);
+    }
+
+    void setStat(size_t index, const struct stat& st) {
+        Entry& entry = records[index];
+        entry.size = st.st_size;
+        entry.mtime = st.st_mtime;
+        entry.mode = st.st_mode;
+        entry.uid = st.st_uid;
+        entry.gid = st.st_gid;
+        // Keep the dirent type so symlinks stay recognisable after stat()
+        // has followed them
+        if (entry.type == DT_UNKNOWN) entry.type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        entry.hasStat = true;
+    }
+
+    // Number of records (including ones later filtered out of the order)
+    size_t recordCount() const { return records.size(); }
+    const Entry& record(size_t index) const { return records[index]; }
+    const char* name(size_t index) const { return arena.data() + records[index].nameOffset; }
+
+    bool isDirectory(size_t index) const {
+        const Entry& entry = records[index];
+        return entry.hasStat ? S_ISDIR(entry.mode) : entry.type == DT_DIR;
+    }
+
+    // Display order: record indices, initially in directory order
+    const vector<uint32_t>& order() const { return view; }
+    vector<uint32_t>& order() { return view; }
+    size_t size() const { return view.size(); }
+    bool empty() const { return view.empty(); }
+
+    // Removes the records matching 'drop' from the order, keeping the rest
+    template <typename Predicate>
+    void removeIf(Predicate drop) {
+        view.erase(remove_if(view.begin(), view.end(), drop), view.end());
+    }
+
+    // Directories first, then by name
+    bool lessDirectoriesFirst(uint32_t a, uint32_t b) const {
+        bool aDir = isDirectory(a);
+        bool bDir = isDirectory(b);
+        if (aDir != bDir) return aDir;
+        return strcmp(name(a), name(b)) < 0;
+    }
+
+    void sortDirectoriesFirst() {
+        sortBy([this](uint32_t a, uint32_t b) { return lessDirectoriesFirst(a, b); });
+    }
+
+    // Below this many entries sorting on the pool costs more than it saves
+    static const size_t PARALLEL_SORT_THRESHOLD = 64 * 1024;
+
+    // Sorts the order by 'less' and, when 'limit' is set, keeps only the
+    // first 'limit' entries (partial sort, so the tail is never ordered).
+    // With a pool, large inputs are split into one chunk per thread; the
+    // chunks are (partially) sorted in parallel and merged pairwise.
+    template <typename Compare>
+    void sortBy(const Compare& less, size_t limit = 0, WorkerPool* pool = NULL) {
+        size_t count = view.size();
+        if (limit == 0 || limit > count) limit = count;
+
+        if (pool == NULL || pool->size() < 2 || count < PARALLEL_SORT_THRESHOLD) {
+            if (limit < count) {
+                partial_sort(view.begin(), view.begin() + limit, view.end(), less);
+                view.resize(limit);
+            } else {
+                sort(view.begin(), view.end(), less);
+            }
+            return;
+        }
+
+        size_t chunks = pool->size();
+        vector<size_t> bounds(chunks + 1);
+        for (size_t i = 0; i <= chunks; i++) bounds[i] = count * i / chunks;
+        vector<size_t> kept(chunks);
+        pool->parallelFor(chunks, [&](size_t i) {
+            auto begin = view.begin() + bounds[i];
+            auto end = view.begin() + bounds[i + 1];
+            kept[i] = min(limit, bounds[i + 1] - bounds[i]);
+            if (kept[i] < bounds[i + 1] - bounds[i]) {
+                partial_sort(begin, begin + kept[i], end, less);
+            } else {
+                sort(begin, end, less);
+            }
+        }, 1);
+
+        // Pack the kept prefix of every chunk together, then merge the runs
+        vector<size_t> runs(1, 0);
+        size_t packed = 0;
+        for (size_t i = 0; i < chunks; i++) {
+            if (packed != bounds[i]) {
+                copy(view.begin() + bounds[i], view.begin() + bounds[i] + kept[i], view.begin() + packed);
+            }
+            packed += kept[i];
+            runs.push_back(packed);
+        }
+        view.resize(packed);
+        while (runs.size() > 2) {
+            size_t pairs = (runs.size() - 1) / 2;
+            pool->parallelFor(pairs, [&](size_t p) {
+                inplace_merge(view.begin() + runs[2 * p], view.begin() + runs[2 * p + 1],
+                              view.begin() + runs[2 * p + 2], less);
+            }, 1);
+            vector<size_t> merged;
+            for (size_t i = 0; i < runs.size(); i += 2) merged.push_back(runs[i]);
+            if (merged.back() != runs.back()) merged.push_back(runs.back());
+            runs.swap(merged);
+        }
+        view.resize(limit);
+    }
+
+    // Bytes held by the arena, the records and the order vector
+    size_t memoryBytes() const {
+        return arena.capacity() + records.capacity() * sizeof(Entry) +
+               view.capacity() * sizeof(uint32_t);
+    }
+
+    double bytesPerEntry() const {
+        return records.empty() ? 0.0 : static_cast<double>(memoryBytes()) / records.size();
+    }
+};
+
+// Helper class to scan a directory through a single open fd
+class DirectoryScanner {
+public:
+    // Below this many stat calls the worker pool costs more than it saves
+    static const size_t PARALLEL_STAT_THRESHOLD = 512;
+
+    // Reads every entry of 'path' into 'snapshot'. Stat records are fetched
+    // with fstatat() relative to the directory fd when 'withStat' is set;
+    // otherwise only symlinks and entries with an unknown d_type are stat'ed.
+    // When a pool is given, the stat calls are spread across its threads;
+    // entries keep their directory order either way. Entries whose stat
+    // fails are dropped from the order, like the old stat() loop did.
+    static bool scan(const string& path, bool withStat, DirSnapshot& snapshot,
+                     WorkerPool* pool = NULL) {
+        int dirFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            return false;
+        }
+        bool ok = scanAt(dirFd, withStat, snapshot, pool);
+        close(dirFd);
+        return ok;
+    }
+
+    // Same as scan() on a freshly opened directory fd, which stays open
+    static bool scanAt(int dirFd, bool withStat, DirSnapshot& snapshot, WorkerPool* pool = NULL) {
+        bool ok = readAt(dirFd, snapshot);
+        statAt(dirFd, withStat, snapshot, pool);
+        return ok;
+    }
+
+    // First half of scanAt(): names and d_types only, no stat calls
+    static bool readAt(int dirFd, DirSnapshot& snapshot) {
+        ScopedPhase timer(PHASE_READDIR);
+        DirReader reader(dirFd);
+        const char* name;
+        unsigned char type;
+        while (reader.next(name, type)) {
+            snapshot.add(name, type);
+        }
+        return reader.error() == 0;
+    }
+
+    // Second half of scanAt(): fetches the stat records for the entries in
+    // the snapshot's order (all of them, or only symlinks and unknown
+    // types without 'withStat') and drops the entries whose stat fails
+    static void statAt(int dirFd, bool withStat, DirSnapshot& snapshot, WorkerPool* pool = NULL) {
+        vector<uint32_t> statIndices;
+        for (uint32_t index : snapshot.order()) {
+            unsigned char type = snapshot.record(index).type;
+            if (withStat || type == DT_LNK || type == DT_UNKNOWN) {
+                statIndices.push_back(index);
+            }
+        }
+
+        // Each task writes only its own record, so no locking is needed
+        vector<char> failed(snapshot.recordCount(), 0);
+        auto statOne = [&](size_t i) {
+            struct stat st;
+            if (countedStat(dirFd, snapshot.name(statIndices[i]), &st, 0) == 0) {
+                snapshot.setStat(statIndices[i], st);
+            } else {
+                failed[statIndices[i]] = 1;
+            }
+        };
+        {
+            ScopedPhase timer(PHASE_STAT);
+            if (pool != NULL && pool->size() > 1 && statIndices.size() >= PARALLEL_STAT_THRESHOLD) {
+                pool->parallelFor(statIndices.size(), statOne);
+            } else {
+                for (size_t i = 0; i < statIndices.size(); i++) statOne(i);
+            }
+        }
+
+        snapshot.removeIf([&failed](uint32_t index) { return failed[index] != 0; });
+    }
+};
+
+// LRU cache of directory snapshots keyed by (st_dev, st_ino). An entry is
+// reused while the directory's mtime and ctime are unchanged, so listing
+// an unchanged directory skips reading it. Only names and d_types are
+// cached: writing to a file changes its size and times but not the
+// directory, so stat data is always fetched fresh. Directories changed
+// within the last second are not cached, since a second change in the
+// same timestamp tick would go unnoticed.
+class DirSnapshotCache {
+public:
+    static const size_t DEFAULT_MEMORY_LIMIT = 64 * 1024 * 1024;
+
+private:
+    struct Key {
+        dev_t dev;
+        ino_t ino;
+
+        bool operator==(const Key& other) const {
+            return dev == other.dev && ino == other.ino;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return hash<unsigned long long>()(key.ino) * 31 + hash<unsigned long long>()(key.dev);
+        }
+    };
+
+    struct Slot {
+        DirSnapshot snapshot;
+        struct timespec mtime;
+        struct timespec ctime;
+        size_t bytes;
+        list<Key>::iterator lruPos;
+    };
+
+    unordered_map<Key, Slot, KeyHash> slots;
+    list<Key> lru;  // most recently used at the front
+    size_t memoryLimit;
+    size_t memoryUsed;
+    unsigned long hitCount;
+    unsigned long missCount;
+    unsigned long staleCount;
+    unsigned long evictionCount;
+
+    static bool sameTime(const struct timespec& a, const struct timespec& b) {
+        return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    }
+
+    void erase(unordered_map<Key, Slot, KeyHash>::iterator it) {
+        memoryUsed -= it->second.bytes;
+        lru.erase(it->second.lruPos);
+        slots.erase(it);
+    }
+
+    void evictToFit(size_t incoming) {
+        while (!lru.empty() && memoryUsed + incoming > memoryLimit) {
+            erase(slots.find(lru.back()));
+            evictionCount++;
+        }
+    }
+
+    // Keeps a copy of a names-only snapshot
+    void store(const Key& key, const struct stat& dirStat, const DirSnapshot& snapshot) {
+        DirSnapshot copy(snapshot);
+        size_t bytes = copy.memoryBytes() + sizeof(Slot) + sizeof(Key);
+        if (bytes > memoryLimit) {
+            return;
+        }
+        evictToFit(bytes);
+        lru.push_front(key);
+        Slot& slot = slots[key];
+        slot.snapshot = move(copy);
+        slot.mtime = dirStat.st_mtim;
+        slot.ctime = dirStat.st_ctim;
+        slot.bytes = bytes;
+        slot.lruPos = lru.begin();
+        memoryUsed += bytes;
+    }
+
+public:
+    DirSnapshotCache()
+        : memoryLimit(DEFAULT_MEMORY_LIMIT), memoryUsed(0),
+          hitCount(0), missCount(0), staleCount(0), evictionCount(0) {}
+
+    // Fills 'snapshot' with the entries of 'path' in directory order, the
+    // names from the cache when possible. Stat data is present when
+    // 'withStat' is set, as with DirectoryScanner::scan.
+    bool load(const string& path, bool withStat, DirSnapshot& snapshot, WorkerPool* pool = NULL) {
+        int dirFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            return false;
+        }
+        struct stat dirStat;
+        if (countedStat(dirFd, "", &dirStat, AT_EMPTY_PATH) != 0) {
+            close(dirFd);
+            return false;
+        }
+
+        Key key = {dirStat.st_dev, dirStat.st_ino};
+        auto it = slots.find(key);
+        if (it != slots.end()) {
+            Slot& slot = it->second;
+            if (!sameTime(slot.mtime, dirStat.st_mtim) || !sameTime(slot.ctime, dirStat.st_ctim)) {
+                erase(it);
+                staleCount++;
+            } else {
+                lru.splice(lru.begin(), lru, slot.lruPos);
+                snapshot = slot.snapshot;
+                hitCount++;
+                DirectoryScanner::statAt(dirFd, withStat, snapshot, withStat ? pool : NULL);
+                close(dirFd);
+                return true;
+            }
+        }
+        missCount++;
+        snapshot.clear();
+
+        // fstat before reading: a change during the scan leaves a newer
+        // mtime, which invalidates the entry on the next lookup
+        time_t scanStart = time(NULL);
+        bool ok = DirectoryScanner::readAt(dirFd, snapshot);
+        if (ok && dirStat.st_mtim.tv_sec + 1 < scanStart && dirStat.st_ctim.tv_sec + 1 < scanStart) {
+            store(key, dirStat, snapshot);
+        }
+        DirectoryScanner::statAt(dirFd, withStat, snapshot, withStat ? pool : NULL);
+        close(dirFd);
+        return ok;
+    }
+
+    void setMemoryLimit(size_t bytes) {
+        memoryLimit = bytes;
+        evictToFit(0);
+    }
+
+    void clear() {
+        slots.clear();
+        lru.clear();
+        memoryUsed = 0;
+    }
+
+    size_t size() const { return slots.size(); }
+    size_t memoryBytes() const { return memoryUsed; }
+    size_t getMemoryLimit() const { return memoryLimit; }
+    unsigned long hits() const { return hitCount; }
+    unsigned long misses() const { return missCount; }
+    unsigned long staleEntries() const { return staleCount; }
+    unsigned long evictions() const { return evictionCount; }
+};
+
+// Helper class that serves a directory one page at a time, so a directory
+// with millions of entries never has more than a few pages of names in
+// memory. SORTED pages (directories first, then by name) are picked by
+// streaming the directory through a bounded max-heap of up to WINDOW_PAGES
+// pages of entries that sort after the last entry shown before them. That
+// sorted window serves next/prev until they leave it, so paging through
+// the whole directory reads it once per window instead of once per page.
+// DIRECTORY_ORDER pages skip sorting entirely: the directory fd stays open
+// and reading resumes at the saved getdents cookie, so the first page
+// appears after one batch.
+class DirectoryPager {
+public:
+    enum Order { SORTED, DIRECTORY_ORDER };
+    // SORTED: pages kept from one read of the directory, fewer when that
+    // would be more than WINDOW_ENTRIES names
+    static const size_t WINDOW_PAGES = 8;
+    static const size_t WINDOW_ENTRIES = 65536;
+
+private:
+    struct Key {
+        bool isDir;
+        string name;
+    };
+
+    string path;
+    int dirFd;
+    Order order;
+    size_t pageSize;
+    size_t page;
+    size_t totalEntries;    // SORTED: entries seen by the last scan
+    bool lastPage;
+    // SORTED: boundaries[k] is the last key shown on page k
+    vector<Key> boundaries;
+    // SORTED: entries of pages windowFirst.. in display order, and how
+    // many entries sorted after the page before windowFirst
+    vector<Key> window;
+    size_t windowFirst;
+    size_t windowRemaining;
+    // DIRECTORY_ORDER: offsets[k] is the cookie where page k starts
+    vector<off64_t> offsets;
+    unique_ptr<DirReader> reader;
+    size_t readerPage;      // page the reader cursor currently continues
+    bool hasPending;        // entry read ahead to detect the last page
+    string pendingName;
+    unsigned char pendingType;
+
+    // Directories first, then by name
+    static bool keyLess(bool aDir, const char* aName, bool bDir, const char* bName) {
+        if (aDir != bDir) return aDir;
+        return strcmp(aName, bName) < 0;
+    }
+
+    struct HeapLess {
+        bool operator()(const Key& a, const Key& b) const {
+            return keyLess(a.isDir, a.name.c_str(), b.isDir, b.name.c_str());
+        }
+    };
+
+    // Resolves d_type for symlinks and unknown types like the scanner does;
+    // returns false when the entry cannot be stat'ed
+    bool resolveType(const char* name, unsigned char& type) const {
+        if (type != DT_LNK && type != DT_UNKNOWN) return true;
+        struct stat st;
+        if (countedStat(dirFd, name, &st, 0) != 0) return false;
+        type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        return true;
+    }
+
+    size_t windowPages() const {
+        return max<size_t>(1, min(static_cast<size_t>(WINDOW_PAGES), WINDOW_ENTRIES / pageSize));
+    }
+
+    // Reads the directory once to fill the window with the pages from
+    // 'firstPage' on (boundaries[firstPage - 1] must be known)
+    bool scanWindow(size_t firstPage) {
+        const Key* after = firstPage > 0 ? &boundaries[firstPage - 1] : NULL;
+        size_t capacity = pageSize * windowPages();
+
+        DirReader scanReader(dirFd);
+        if (!scanReader.seek(0)) return false;
+        vector<Key> heap;
+        heap.reserve(pageSize);
+        HeapLess less;
+        size_t remaining = 0;
+        totalEntries = 0;
+        const char* name;
+        unsigned char type;
+        while (scanReader.next(name, type)) {
+            if (!resolveType(name, type)) continue;
+            totalEntries++;
+            bool isDir = type == DT_DIR;
+            if (after != NULL && !keyLess(after->isDir, after->name.c_str(), isDir, name)) continue;
+            remaining++;
+            if (heap.size() < capacity) {
+                heap.push_back(Key());
+                heap.back().isDir = isDir;
+                heap.back().name = name;
+                push_heap(heap.begin(), heap.end(), less);
+            } else if (keyLess(isDir, name, heap.front().isDir, heap.front().name.c_str())) {
+                // Replace the largest key in place, reusing its string storage
+                pop_heap(heap.begin(), heap.end(), less);
+                heap.back().isDir = isDir;
+                heap.back().name.assign(name);
+                push_heap(heap.begin(), heap.end(), less);
+            }
+        }
+        if (scanReader.error() != 0) return false;
+        sort_heap(heap.begin(), heap.end(), less);
+
+        window.swap(heap);
+        windowFirst = firstPage;
+        windowRemaining = remaining;
+        boundaries.resize(firstPage);
+        for (size_t end = pageSize; end - pageSize < window.size(); end += pageSize) {
+            boundaries.push_back(window[min(end, window.size()) - 1]);
+        }
+        return true;
+    }
+
+    bool loadSorted(size_t pageNumber, DirSnapshot& entries) {
+        if (pageNumber > boundaries.size()) return false;
+        size_t pages = windowPages();
+        if (window.empty() || pageNumber < windowFirst || pageNumber >= windowFirst + pages) {
+            // Going back, end the window here so the pages before are in it
+            size_t firstPage = pageNumber;
+            if (!window.empty() && pageNumber < windowFirst) {
+                firstPage = pageNumber + 1 >= pages ? pageNumber + 1 - pages : 0;
+            }
+            if (!scanWindow(firstPage)) return false;
+        }
+
+        size_t begin = (pageNumber - windowFirst) * pageSize;
+        if (begin >= window.size() && pageNumber > 0) return false;
+        size_t end = min(begin + pageSize, window.size());
+        lastPage = windowRemaining <= end;
+        for (size_t i = begin; i < end; i++) {
+            const Key& key = window[i];
+            entries.add(key.name.data(), key.name.size(), key.isDir ? DT_DIR : DT_REG);
+        }
+        return true;
+    }
+
+    bool loadDirectoryOrder(size_t pageNumber, DirSnapshot& entries) {
+        if (pageNumber >= offsets.size()) return false;
+        if (!reader || readerPage != pageNumber) {
+            if (!reader) reader.reset(new DirReader(dirFd));
+            if (!reader->seek(offsets[pageNumber])) return false;
+            hasPending = false;
+        }
+
+        const char* name;
+        unsigned char type;
+        if (hasPending) {
+            entries.add(pendingName.data(), pendingName.size(), pendingType);
+            hasPending = false;
+        }
+        while (entries.size() < pageSize && reader->next(name, type)) {
+            if (!resolveType(name, type)) continue;
+            entries.add(name, type);
+        }
+        if (reader->error() != 0 || (entries.empty() && pageNumber > 0)) return false;
+
+        // Read one entry ahead so the last page is known as such
+        off64_t nextOffset = reader->position();
+        lastPage = true;
+        while (reader->next(name, type)) {
+            if (!resolveType(name, type)) {
+                nextOffset = reader->position();
+                continue;
+            }
+            pendingName = name;
+            pendingType = type;
+            hasPending = true;
+            lastPage = false;
+            break;
+        }
+        offsets.resize(pageNumber + 1);
+        if (!lastPage) offsets.push_back(nextOffset);
+        readerPage = pageNumber + 1;
+        return true;
+    }
+
+public:
+    DirectoryPager(const string& dirPath, Order pageOrder, size_t entriesPerPage)
+        : path(dirPath), dirFd(-1), order(pageOrder), pageSize(max<size_t>(1, entriesPerPage)),
+          page(0), totalEntries(0), lastPage(true), windowFirst(0), windowRemaining(0),
+          offsets(1, 0), readerPage(0),
+          hasPending(false), pendingType(DT_UNKNOWN) {
+        dirFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+
+    ~DirectoryPager() {
+        if (dirFd >= 0) close(dirFd);
+    }
+
+    bool isOpen() const { return dirFd >= 0; }
+    const string& getPath() const { return path; }
+    Order getOrder() const { return order; }
+    size_t getPageSize() const { return pageSize; }
+    size_t currentPage() const { return page; }
+    bool isLastPage() const { return lastPage; }
+    // Only known in SORTED order, which reads the whole directory per window
+    size_t knownTotal() const { return order == SORTED ? totalEntries : 0; }
+
+    // Loads page 'pageNumber' into 'entries' (names and types only, in
+    // display order; the snapshot is cleared first), stat'ing each entry
+    // when 'withStat' is set. Only pages up to one past the furthest page
+    // shown so far can be reached.
+    bool load(size_t pageNumber, bool withStat, DirSnapshot& entries) {
+        if (dirFd < 0) return false;
+        entries.clear();
+        bool ok = order == SORTED ? loadSorted(pageNumber, entries)
+                                  : loadDirectoryOrder(pageNumber, entries);
+        if (!ok) return false;
+        page = pageNumber;
+
+        if (withStat) {
+            for (size_t i = 0; i < entries.recordCount(); i++) {
+                struct stat st;
+                if (countedStat(dirFd, entries.name(i), &st, 0) == 0) entries.setStat(i, st);
+            }
+            entries.removeIf([&entries](uint32_t index) { return !entries.record(index).hasStat; });
+        }
+        return true;
+    }
+};
+
+// Helper class that copies file contents with the cheapest mechanism the
+// kernel and filesystem offer: reflink (FICLONE), copy_file_range(),
+// sendfile(), and finally an aligned read/write loop. Holes in sparse
+// sources are skipped with SEEK_DATA/SEEK_HOLE.
+class CopyEngine {
+public:
+    enum Tier { TIER_COPY_FILE_RANGE, TIER_SENDFILE, TIER_READ_WRITE };
+
+    static const size_t IO_BUFFER_SIZE = 1024 * 1024;
+    static const size_t IO_ALIGNMENT = 4096;
+
+private:
+    // Errors meaning "this mechanism does not apply here", as opposed to a
+    // real I/O failure
+    static bool isUnsupported(int err) {
+        return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP
+            || err == ENOTSUP || err == EBADF || err == ETXTBSY;
+    }
+
+    static bool copyWithReadWrite(int srcFd, int destFd, off_t offset, off_t length, bool untilEof) {
+        void* raw = NULL;
+        if (posix_memalign(&raw, IO_ALIGNMENT, IO_BUFFER_SIZE) != 0) {
+            return false;
+        }
+        unique_ptr<char, void (*)(void*)> buffer(static_cast<char*>(raw), free);
+
+        while (untilEof || length > 0) {
+            size_t want = IO_BUFFER_SIZE;
+            if (!untilEof && static_cast<off_t>(want) > length) want = static_cast<size_t>(length);
+            ssize_t got = pread(srcFd, buffer.get(), want, offset);
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            if (got == 0) return untilEof;
+            Profiler::instance().count(COUNTER_COPY_BYTES, got);
+
+            for (ssize_t done = 0; done < got;) {
+                ssize_t put = pwrite(destFd, buffer.get() + done, got - done, offset + done);
+                if (put < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                done += put;
+            }
+            offset += got;
+            length -= got;
+        }
+        return true;
+    }
+
+public:
+    // Copies [offset, offset + length) of srcFd to the same offset in
+    // destFd. 'tier' starts at the best mechanism and is lowered as
+    // mechanisms turn out not to work, so later ranges skip them.
+    // 'sharedDest' is set when other threads write to destFd at the same
+    // time: sendfile() writes at the fd's file offset, so only the
+    // positional tiers (copy_file_range, pwrite) are used then.
+    static bool copyRange(int srcFd, int destFd, off_t offset, off_t length, Tier& tier,
+                          bool sharedDest = false) {
+        if (sharedDest && tier == TIER_SENDFILE) tier = TIER_READ_WRITE;
+        if (tier == TIER_COPY_FILE_RANGE) {
+            loff_t inOff = offset, outOff = offset;
+            off_t remaining = length;
+            errno = 0;
+            while (remaining > 0) {
+                ssize_t n = copy_file_range(srcFd, &inOff, destFd, &outOff, remaining, 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                Profiler::instance().count(COUNTER_COPY_BYTES, n);
+                remaining -= n;
+            }
+            if (remaining == 0) return true;
+            if (errno != 0 && !isUnsupported(errno)) return false;
+            // Resume from wherever copy_file_range stopped
+            tier = sharedDest ? TIER_READ_WRITE : TIER_SENDFILE;
+            length = remaining;
+            offset = inOff;
+        }
+
+        if (tier == TIER_SENDFILE) {
+            off_t inOff = offset;
+            off_t remaining = length;
+            errno = 0;
+            if (lseek(destFd, offset, SEEK_SET) == offset) {
+                while (remaining > 0) {
+                    ssize_t n = sendfile(destFd, srcFd, &inOff, remaining);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) break;
+                    Profiler::instance().count(COUNTER_COPY_BYTES, n);
+                    remaining -= n;
+                }
+            }
+            if (remaining == 0) return true;
+            if (errno != 0 && !isUnsupported(errno)) return false;
+            tier = TIER_READ_WRITE;
+            length = remaining;
+            offset = inOff;
+        }
+
+        return copyWithReadWrite(srcFd, destFd, offset, length, false);
+    }
+
+    // Copies the whole of srcFd into the (empty) destFd
+    static bool copyContents(int srcFd, int destFd, const struct stat& srcStat) {
+        // Same-filesystem reflink: shares extents, no data is moved
+        if (S_ISREG(srcStat.st_mode) && ioctl(destFd, FICLONE, srcFd) == 0) {
+            return true;
+        }
+
+        // Pseudo files (procfs etc.) report size 0 but still have content
+        if (!S_ISREG(srcStat.st_mode) || srcStat.st_size == 0) {
+            return copyWithReadWrite(srcFd, destFd, 0, 0, true);
+        }
+
+        Tier tier = TIER_COPY_FILE_RANGE;
+        off_t size = srcStat.st_size;
+        bool sparse = static_cast<off_t>(srcStat.st_blocks) * 512 < size;
+        if (!sparse) {
+            return copyRange(srcFd, destFd, 0, size, tier);
+        }
+
+        // Copy only the data extents, then extend the file over any
+        // trailing hole
+        off_t offset = 0;
+        while (offset < size) {
+            off_t dataStart = lseek(srcFd, offset, SEEK_DATA);
+            if (dataStart < 0) {
+                if (errno == ENXIO) break;  // only a hole remains
+                return copyRange(srcFd, destFd, offset, size - offset, tier);
+            }
+            off_t dataEnd = lseek(srcFd, dataStart, SEEK_HOLE);
+            if (dataEnd < 0 || dataEnd > size) dataEnd = size;
+            if (!copyRange(srcFd, destFd, dataStart, dataEnd - dataStart, tier)) {
+                return false;
+            }
+            offset = dataEnd;
+        }
+        return ftruncate(destFd, size) == 0;
+    }
+};
+
+// Per-file failures and totals of a parallel tree copy
+struct CopyReport {
+    size_t files;
+    size_t directories;
+    unsigned long long bytes;
+    double seconds;
+    vector<pair<string, string>> errors;  // path, reason
+
+    CopyReport() : files(0), directories(0), bytes(0), seconds(0) {}
+};
+
+// Helper class that copies a directory tree using a WorkerPool. A single
+// walker thread creates the destination directories in order and hands
+// every file to the pool; files larger than two chunks are split so one
+// huge file does not hold up the rest of the job. Errors are collected per
+// file instead of aborting the copy.
+class ParallelTreeCopier {
+public:
+    static const off_t CHUNK_SIZE = 64 * 1024 * 1024;
+    // The walker stops queueing and helps out beyond this many tasks per thread
+    static const size_t MAX_QUEUED_PER_THREAD = 1024;
+
+private:
+    // Open file pair shared by the chunk tasks of one large file
+    struct SharedCopy {
+        int srcFd;
+        int destFd;
+        mode_t mode;
+        string srcPath;
+        ParallelTreeCopier* owner;
+        atomic<bool> failed;
+        atomic<int> error;  // errno of the first failure, 0 if unknown
+
+        SharedCopy() : srcFd(-1), destFd(-1), mode(0), owner(NULL), failed(false), error(0) {}
+
+        void fail(int errorNumber) {
+            int none = 0;
+            error.compare_exchange_strong(none, errorNumber);
+            failed = true;
+        }
+
+        ~SharedCopy() {
+            if (!failed) fchmod(destFd, mode);
+            if (destFd >= 0 && close(destFd) != 0) fail(errno);
+            if (srcFd >= 0) close(srcFd);
+            if (failed) owner->recordError(srcPath, error != 0 ? strerror(error) : "chunked copy failed");
+            else owner->filesDone++;
+        }
+    };
+
+    WorkerPool& pool;
+    WorkerPool::TaskGroup group;
+    mutex errorMutex;
+    vector<pair<string, string>> errors;
+    atomic<size_t> filesDone;
+    atomic<unsigned long long> bytesDone;
+    vector<pair<string, mode_t>> createdDirs;
+
+    void recordError(const string& path, const string& reason) {
+        lock_guard<mutex> lock(errorMutex);
+        errors.push_back(make_pair(path, reason));
+    }
+
+    void copyOneFile(const string& srcPath, const string& destPath) {
+        int srcFd = open(srcPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (srcFd < 0) {
+            recordError(srcPath, strerror(errno));
+            return;
+        }
+        struct stat srcStat;
+        if (countedStat(srcFd, "", &srcStat, AT_EMPTY_PATH) != 0) {
+            recordError(srcPath, strerror(errno));
+            close(srcFd);
+            return;
+        }
+        int destFd = open(destPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (destFd < 0) {
+            recordError(destPath, strerror(errno));
+            close(srcFd);
+            return;
+        }
+
+        // Large files are split across the pool unless a reflink already
+        // copied them; the clone result is kept so it is not tried twice
+        bool sparse = static_cast<off_t>(srcStat.st_blocks) * 512 < srcStat.st_size;
+        bool large = S_ISREG(srcStat.st_mode) && !sparse && srcStat.st_size > 2 * CHUNK_SIZE;
+        bool cloned = large && ioctl(destFd, FICLONE, srcFd) == 0;
+        bool chunked = large && !cloned && ftruncate(destFd, srcStat.st_size) == 0;
+        if (chunked) {
+            shared_ptr<SharedCopy> shared = make_shared<SharedCopy>();
+            shared->srcFd = srcFd;
+            shared->destFd = destFd;
+            shared->mode = srcStat.st_mode & 07777;
+            shared->srcPath = srcPath;
+            shared->owner = this;
+            for (off_t offset = 0; offset < srcStat.st_size; offset += CHUNK_SIZE) {
+                off_t length = min(static_cast<off_t>(CHUNK_SIZE), srcStat.st_size - offset);
+                pool.submit(group, [this, shared, offset, length]() {
+                    CopyEngine::Tier tier = CopyEngine::TIER_COPY_FILE_RANGE;
+                    if (shared->failed) return;
+                    if (CopyEngine::copyRange(shared->srcFd, shared->destFd, offset, length, tier, true)) {
+                        bytesDone += length;
+                    } else {
+                        shared->fail(errno);
+                    }
+                });
+            }
+            return;
+        }
+
+        bool success = cloned || CopyEngine::copyContents(srcFd, destFd, srcStat);
+        int error = success ? 0 : errno;
+        if (success) fchmod(destFd, srcStat.st_mode & 07777);
+        close(srcFd);
+        if (close(destFd) != 0 && success) {
+            success = false;
+            error = errno;
+        }
+
+        if (success) {
+            filesDone++;
+            bytesDone += srcStat.st_size;
+        } else {
+            recordError(srcPath, error ? strerror(error) : "copy failed");
+        }
+    }
+
+    // Walk one source directory, creating it at destPath and queueing its files
+    void walk(const string& srcPath, const string& destPath, mode_t mode) {
+        // Keep the directory writable until every file has landed; the
+        // real mode is applied at the end
+        if (mkdir(destPath.c_str(), mode | S_IRWXU) != 0) {
+            recordError(destPath, strerror(errno));
+            return;
+        }
+        createdDirs.push_back(make_pair(destPath, mode));
+
+        int dirFd = open(srcPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            recordError(srcPath, strerror(errno));
+            return;
+        }
+
+        vector<pair<string, mode_t>> subdirs;
+        DirReader reader(dirFd);
+        const char* name;
+        unsigned char type;
+        while (reader.next(name, type)) {
+            // Skip . and ..
+            if (isDotOrDotDot(name)) continue;
+
+            string srcFullPath = srcPath + "/" + name;
+            string destFullPath = destPath + "/" + name;
+
+            // Symlinks are followed, as the original serial copy did
+            bool isDir = type == DT_DIR;
+            mode_t dirMode = 0755;
+            if (type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN) {
+                struct stat fileStat;
+                if (countedStat(dirFd, name, &fileStat, 0) != 0) {
+                    recordError(srcFullPath, strerror(errno));
+                    continue;
+                }
+                isDir = S_ISDIR(fileStat.st_mode);
+                dirMode = fileStat.st_mode & 07777;
+            }
+
+            if (isDir) {
+                subdirs.push_back(make_pair(name, dirMode));
+            } else {
+                while (pool.pending() > MAX_QUEUED_PER_THREAD * pool.size() && pool.helpOne()) {
+                }
+                pool.submit(group, [this, srcFullPath, destFullPath]() {
+                    copyOneFile(srcFullPath, destFullPath);
+                });
+            }
+        }
+        if (reader.error() != 0) {
+            recordError(srcPath, strerror(reader.error()));
+        }
+        close(dirFd);
+
+        for (const auto& subdir : subdirs) {
+            walk(srcPath + "/" + subdir.first, destPath + "/" + subdir.first, subdir.second);
+        }
+    }
+
+public:
+    explicit ParallelTreeCopier(WorkerPool& workerPool) : pool(workerPool), filesDone(0), bytesDone(0) {}
+
+    // Thread count for copying onto the device holding 'path': enough to
+    // keep the device queue busy without oversubscribing the CPUs
+    static unsigned suggestedThreads(const string& path) {
+        unsigned cores = max(1u, thread::hardware_concurrency());
+        unsigned threads = max(4u, 2 * cores);
+
+        struct stat pathStat;
+        if (countedStat(AT_FDCWD, path.c_str(), &pathStat, 0) == 0 && major(pathStat.st_dev) != 0) {
+            char sysPath[128];
+            unsigned queueDepth = 0;
+            const char* patterns[] = {"/sys/dev/block/%u:%u/queue/nr_requests",
+                                      "/sys/dev/block/%u:%u/../queue/nr_requests"};
+            for (const char* pattern : patterns) {
+                snprintf(sysPath, sizeof(sysPath), pattern,
+                         major(pathStat.st_dev), minor(pathStat.st_dev));
+                ifstream file(sysPath);
+                if (file >> queueDepth) break;
+            }
+            if (queueDepth > 0) threads = min(threads * 2, queueDepth);
+        }
+        return min(max(threads, 1u), 64u);
+    }
+
+    CopyReport copyTree(const string& srcPath, const string& destPath) {
+        CopyReport report;
+        auto start = chrono::steady_clock::now();
+
+        struct stat srcStat;
+        if (countedStat(AT_FDCWD, srcPath.c_str(), &srcStat, 0) != 0) {
+            report.errors.push_back(make_pair(srcPath, strerror(errno)));
+            return report;
+        }
+        walk(srcPath, destPath, srcStat.st_mode & 07777);
+        pool.wait(group);
+
+        // Apply the real directory modes, deepest first
+        for (auto it = createdDirs.rbegin(); it != createdDirs.rend(); ++it) {
+            chmod(it->first.c_str(), it->second);
+        }
+
+        report.files = filesDone.load();
+        report.directories = createdDirs.size();
+        report.bytes = bytesDone.load();
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        report.errors = errors;
+        return report;
+    }
+};
+
+// Helper class that moves a tree to another filesystem as a pipeline:
+// every file is copied, fsync'ed, checked for its full size and only then
+// deleted from the source, so the extra space in use never exceeds the
+// files in flight. Progress is appended to a journal next to the
+// destination (".<name>.fe-move"); when a move is interrupted, running it
+// again with the same source and destination picks up where it stopped:
+// whatever is still in the source is moved, and files half-copied before
+// the interruption are copied again. Symlinks are moved as symlinks.
+class ResumableMover {
+public:
+    static const size_t MAX_QUEUED_PER_THREAD = 256;
+
+    struct Progress {
+        unsigned long long totalBytes;
+        size_t totalFiles;
+        unsigned long long previousBytes;   // moved before a resume
+        size_t previousFiles;
+
+        Progress() : totalBytes(0), totalFiles(0), previousBytes(0), previousFiles(0) {}
+    };
+
+private:
+    WorkerPool& pool;
+    WorkerPool::TaskGroup group;
+    mutex errorMutex;
+    vector<pair<string, string>> errors;
+    atomic<size_t> filesDone;
+    atomic<unsigned long long> bytesDone;
+    vector<pair<string, struct stat>> destDirs;     // walk order
+    vector<string> srcDirs;                         // walk order
+    mutex journalMutex;
+    int journalFd;
+
+    // Group commit for directory fsyncs: a caller whose entry is already
+    // in a directory waits for one fsync of it that starts after the call,
+    // so files finishing together share a single fsync per directory
+    struct DirSync {
+        mutex lock;
+        condition_variable done;
+        unsigned long long started;
+        unsigned long long finished;
+        bool running;
+        int lastError;
+
+        DirSync() : started(0), finished(0), running(false), lastError(0) {}
+    };
+    mutex dirSyncMutex;
+    unordered_map<string, shared_ptr<DirSync>> dirSyncs;
+
+    static string parentOf(const string& path) {
+        size_t slash = path.find_last_of('/');
+        if (slash == string::npos) return ".";
+        return slash == 0 ? "/" : path.substr(0, slash);
+    }
+
+    // Makes the entries created so far in dirPath durable; 0 or an errno
+    int syncDirectory(const string& dirPath) {
+        shared_ptr<DirSync> state;
+        {
+            lock_guard<mutex> lock(dirSyncMutex);
+            shared_ptr<DirSync>& slot = dirSyncs[dirPath];
+            if (!slot) slot = make_shared<DirSync>();
+            state = slot;
+        }
+        unique_lock<mutex> lock(state->lock);
+        // An fsync already running may have missed this entry
+        unsigned long long needed = state->started + 1;
+        while (state->finished < needed) {
+            if (state->running) {
+                state->done.wait(lock);
+                continue;
+            }
+            state->running = true;
+            unsigned long long generation = ++state->started;
+            lock.unlock();
+            int dirFd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            int error = (dirFd < 0 || fsync(dirFd) != 0) ? errno : 0;
+            if (dirFd >= 0) close(dirFd);
+            lock.lock();
+            state->finished = generation;
+            state->lastError = error;
+            state->running = false;
+            state->done.notify_all();
+        }
+        return state->lastError;
+    }
+
+    void recordError(const string& path, const string& reason) {
+        lock_guard<mutex> lock(errorMutex);
+        errors.push_back(make_pair(path, reason));
+    }
+
+    // "F <bytes> <name length> <relative path>\n"
+    void journalFileDone(const string& relative, unsigned long long bytes) {
+        char prefix[64];
+        int length = snprintf(prefix, sizeof(prefix), "F %llu %zu ", bytes, relative.size());
+        string line(prefix, length);
+        line += relative;
+        line += '\n';
+        lock_guard<mutex> lock(journalMutex);
+        if (write(journalFd, line.data(), line.size()) != static_cast<ssize_t>(line.size())) {
+            // The journal only saves recopying on resume; the move goes on
+        }
+    }
+
+    bool moveSymlink(const string& srcPath, const string& destPath) {
+        vector<char> target(PATH_MAX + 1);
+        ssize_t n = readlink(srcPath.c_str(), target.data(), target.size() - 1);
+        if (n < 0) {
+            recordError(srcPath, strerror(errno));
+            return false;
+        }
+        target[n] = '\0';
+        if (symlink(target.data(), destPath.c_str()) != 0) {
+            // Left over from an interrupted run
+            vector<char> existing(PATH_MAX + 1);
+            ssize_t m = errno == EEXIST ? readlink(destPath.c_str(), existing.data(), existing.size() - 1) : -1;
+            if (m != n || memcmp(existing.data(), target.data(), n) != 0) {
+                recordError(destPath, strerror(errno ? errno : EEXIST));
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool moveRegularFile(const string& srcPath, const string& destPath, const struct stat& srcStat) {
+        int srcFd = open(srcPath.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (srcFd < 0) {
+            recordError(srcPath, strerror(errno));
+            return false;
+        }
+        int destFd = open(destPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (destFd < 0) {
+            recordError(destPath, strerror(errno));
+            close(srcFd);
+            return false;
+        }
+
+        bool ok = CopyEngine::copyContents(srcFd, destFd, srcStat);
+        const char* reason = "copy failed";
+        if (ok) {
+            fchmod(destFd, srcStat.st_mode & 07777);
+            if (fchown(destFd, srcStat.st_uid, srcStat.st_gid) != 0) {
+                // Keeping ownership needs privileges; the data is what matters
+            }
+            struct timespec times[2] = {srcStat.st_atim, srcStat.st_mtim};
+            futimens(destFd, times);
+            // The source goes away next, so the copy must be on disk and whole
+            struct stat destStat;
+            if (fsync(destFd) != 0) {
+                ok = false;
+                reason = "fsync failed";
+            } else if (countedStat(destFd, "", &destStat, AT_EMPTY_PATH) != 0 || destStat.st_size != srcStat.st_size) {
+                ok = false;
+                reason = "size mismatch after copy";
+            }
+        }
+        close(srcFd);
+        if (close(destFd) != 0 && ok) {
+            ok = false;
+            reason = "close failed";
+        }
+        if (!ok) recordError(srcPath, reason);
+        return ok;
+    }
+
+    void moveOne(const string& srcPath, const string& destPath, const string& relative) {
+        struct stat srcStat;
+        if (countedStat(AT_FDCWD, srcPath.c_str(), &srcStat, AT_SYMLINK_NOFOLLOW) != 0) {
+            recordError(srcPath, strerror(errno));
+            return;
+        }
+        bool moved;
+        if (S_ISLNK(srcStat.st_mode)) {
+            moved = moveSymlink(srcPath, destPath);
+        } else if (S_ISREG(srcStat.st_mode)) {
+            moved = moveRegularFile(srcPath, destPath, srcStat);
+        } else {
+            recordError(srcPath, "unsupported file type");
+            moved = false;
+        }
+        if (!moved) return;
+        // The new entry must survive a crash before the source goes away
+        if (int error = syncDirectory(parentOf(destPath))) {
+            recordError(destPath, string("directory fsync failed: ") + strerror(error));
+            return;
+        }
+
+        unsigned long long bytes = S_ISREG(srcStat.st_mode) ? srcStat.st_size : 0;
+        journalFileDone(relative, bytes);
+        Profiler::instance().count(COUNTER_UNLINK_CALLS);
+        if (unlink(srcPath.c_str()) != 0) {
+            recordError(srcPath, string("copied but not removed: ") + strerror(errno));
+        }
+        bytesDone += bytes;
+        filesDone++;
+    }
+
+    void queueFile(const string& srcPath, const string& destPath, const string& relative) {
+        while (pool.pending() > MAX_QUEUED_PER_THREAD * pool.size() && pool.helpOne()) {
+        }
+        pool.submit(group, [this, srcPath, destPath, relative]() {
+            moveOne(srcPath, destPath, relative);
+        });
+    }
+
+    void walk(const string& srcPath, const string& destPath, const string& relative, const struct stat& dirStat) {
+        // Writable until the end; the real mode and times are applied last
+        if (mkdir(destPath.c_str(), (dirStat.st_mode & 07777) | S_IRWXU) != 0) {
+            struct stat existing;
+            if (errno != EEXIST || countedStat(AT_FDCWD, destPath.c_str(), &existing, 0) != 0
+                || !S_ISDIR(existing.st_mode)) {
+                recordError(destPath, strerror(errno));
+                return;
+            }
+        }
+        if (int error = syncDirectory(parentOf(destPath))) {
+            recordError(destPath, string("directory fsync failed: ") + strerror(error));
+            return;
+        }
+        destDirs.push_back(make_pair(destPath, dirStat));
+        srcDirs.push_back(srcPath);
+
+        int dirFd = open(srcPath.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dirFd < 0) {
+            recordError(srcPath, strerror(errno));
+            return;
+        }
+        vector<pair<string, struct stat>> subdirs;
+        DirReader reader(dirFd);
+        const char* name;
+        unsigned char type;
+        while (reader.next(name, type)) {
+            if (isDotOrDotDot(name)) continue;
+            string childRelative = relative.empty() ? string(name) : relative + "/" + name;
+            if (type == DT_DIR || type == DT_UNKNOWN) {
+                struct stat st;
+                if (countedStat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    recordError(srcPath + "/" + name, strerror(errno));
+                    continue;
+                }
+                if (S_ISDIR(st.st_mode)) {
+                    subdirs.push_back(make_pair(string(name), st));
+                    continue;
+                }
+            }
+            queueFile(srcPath + "/" + name, destPath + "/" + name, childRelative);
+        }
+        if (reader.error() != 0) {
+            recordError(srcPath, strerror(reader.error()));
+        }
+        close(dirFd);
+
+        for (const auto& subdir : subdirs) {
+            walk(srcPath + "/" + subdir.first, destPath + "/" + subdir.first,
+                 relative.empty() ? subdir.first : relative + "/" + subdir.first, subdir.second);
+        }
+    }
+
+    // One status line, rewritten in place
+    void printProgress(const Progress& progress, double seconds, bool final) {
+        unsigned long long bytes = bytesDone.load();
+        size_t files = filesDone.load();
+        unsigned long long allBytes = progress.previousBytes + bytes;
+        double rate = seconds > 0 ? bytes / seconds : 0;
+        double fileRate = seconds > 0 ? files / seconds : 0;
+        double percent = progress.totalBytes ? 100.0 * allBytes / progress.totalBytes : 100.0;
+
+        char eta[32] = "--:--";
+        if (rate > 0 && progress.totalBytes > allBytes) {
+            unsigned long left = static_cast<unsigned long>((progress.totalBytes - allBytes) / rate);
+            snprintf(eta, sizeof(eta), "%lu:%02lu:%02lu", left / 3600, left / 60 % 60, left % 60);
+        } else if (progress.totalBytes <= allBytes) {
+            snprintf(eta, sizeof(eta), "0:00:00");
+        }
+        char line[200];
+        snprintf(line, sizeof(line), "\r  %5.1f%%  %.1f / %.1f MB  %zu / %zu files  %.1f MB/s  %.0f files/s  ETA %s ",
+                 min(percent, 100.0), allBytes / 1048576.0, progress.totalBytes / 1048576.0,
+                 progress.previousFiles + files, progress.totalFiles, rate / 1048576.0, fileRate, eta);
+        cout << CYAN << line << RESET;
+        if (final) cout << endl;
+        else cout.flush();
+    }
+
+public:
+    explicit ResumableMover(WorkerPool& workerPool)
+        : pool(workerPool), filesDone(0), bytesDone(0), journalFd(-1) {}
+
+    static string journalPathFor(const string& destPath) {
+        size_t slash = destPath.find_last_of('/');
+        string parent = slash == string::npos ? "." : (slash == 0 ? "/" : destPath.substr(0, slash));
+        string name = slash == string::npos ? destPath : destPath.substr(slash + 1);
+        return (parent == "/" ? "" : parent) + "/." + name + ".fe-move";
+    }
+
+    // Reads a journal: the source it belongs to and what was moved so far
+    static bool readJournal(const string& journalPath, string& srcPath, unsigned long long& bytes, size_t& files) {
+        ifstream journal(journalPath.c_str(), ios::binary);
+        string magic, line;
+        if (!getline(journal, magic) || magic != "FEMOVE 1" || !getline(journal, line)
+            || line.compare(0, 2, "S ") != 0) {
+            return false;
+        }
+        srcPath = line.substr(2);
+        bytes = 0;
+        files = 0;
+        char kind;
+        while (journal.get(kind)) {
+            unsigned long long size = 0;
+            size_t length = 0;
+            if (kind != 'F' || !(journal >> size >> length) || journal.get() != ' ') break;
+            journal.ignore(length);
+            if (journal.get() != '\n') break;
+            bytes += size;
+            files++;
+        }
+        return true;
+    }
+
+    // Moves srcPath to destPath, resuming from the journal when one exists
+    CopyReport move(const string& srcPath, const string& destPath, Progress progress, bool showProgress) {
+        CopyReport report;
+        auto start = chrono::steady_clock::now();
+
+        string journalPath = journalPathFor(destPath);
+        journalFd = open(journalPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (journalFd < 0) {
+            journalFd = open(journalPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0600);
+            string header = "FEMOVE 1\nS " + srcPath + "\n";
+            if (journalFd < 0 || write(journalFd, header.data(), header.size()) != static_cast<ssize_t>(header.size())
+                || fsync(journalFd) != 0) {
+                report.errors.push_back(make_pair(journalPath, strerror(errno)));
+                if (journalFd >= 0) close(journalFd);
+                return report;
+            }
+        }
+
+        // Live progress from a separate thread while the walker and the
+        // pool do the work
+        mutex stopMutex;
+        condition_variable stopSignal;
+        bool stopping = false;
+        thread reporter;
+        if (showProgress) {
+            reporter = thread([&]() {
+                unique_lock<mutex> lock(stopMutex);
+                while (!stopSignal.wait_for(lock, chrono::milliseconds(500), [&] { return stopping; })) {
+                    printProgress(progress,
+                                  chrono::duration<double>(chrono::steady_clock::now() - start).count(), false);
+                }
+            });
+        }
+
+        struct stat srcStat;
+        if (countedStat(AT_FDCWD, srcPath.c_str(), &srcStat, AT_SYMLINK_NOFOLLOW) != 0) {
+            recordError(srcPath, strerror(errno));
+        } else if (S_ISDIR(srcStat.st_mode)) {
+            walk(srcPath, destPath, "", srcStat);
+        } else {
+            size_t slash = srcPath.find_last_of('/');
+            queueFile(srcPath, destPath, slash == string::npos ? srcPath : srcPath.substr(slash + 1));
+        }
+        pool.wait(group);
+
+        // Directory modes and times deepest first, then the emptied
+        // source directories
+        for (auto it = destDirs.rbegin(); it != destDirs.rend(); ++it) {
+            chmod(it->first.c_str(), it->second.st_mode & 07777);
+            struct timespec times[2] = {it->second.st_atim, it->second.st_mtim};
+            utimensat(AT_FDCWD, it->first.c_str(), times, 0);
+        }
+        for (auto it = srcDirs.rbegin(); it != srcDirs.rend(); ++it) {
+            if (rmdir(it->c_str()) != 0 && errors.empty()) {
+                recordError(*it, strerror(errno));
+            }
+        }
+
+        if (showProgress) {
+            {
+                lock_guard<mutex> lock(stopMutex);
+                stopping = true;
+            }
+            stopSignal.notify_all();
+            reporter.join();
+            printProgress(progress, chrono::duration<double>(chrono::steady_clock::now() - start).count(), true);
+        }
+
+        close(journalFd);
+        journalFd = -1;
+        // Keep the journal while anything is left to retry
+        if (errors.empty()) unlink(journalPath.c_str());
+
+        report.files = filesDone.load();
+        report.directories = destDirs.size();
+        report.bytes = bytesDone.load();
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        report.errors = errors;
+        return report;
+    }
+};
+
+// Helper class that removes a directory tree (rm -rf) using only
+// openat()/unlinkat() relative to directory fds: no paths are built and
+// nothing is re-resolved. Entry types come from d_type, and symlinks are
+// removed, never followed. The top levels fan out across a WorkerPool so
+// sibling subtrees are removed in parallel; below that each subtree is
+// removed by an iterative walk that closes ancestor fds once it holds too
+// many and reopens them through ".." on the way back up, so the depth of
+// the tree is not limited by the fd limit.
+class TreeRemover {
+public:
+    static const int PARALLEL_DEPTH = 2;
+
+private:
+    struct Frame {
+        int fd;                          // -1 while closed to save fds
+        string name;                     // name inside the parent directory
+        dev_t dev;
+        ino_t ino;
+        unique_ptr<DirReader> reader;    // dropped together with the fd
+        bool failed;
+        unordered_set<string> failedNames;  // skipped when re-reading
+
+        Frame() : fd(-1), dev(0), ino(0), failed(false) {}
+    };
+
+    WorkerPool* pool;
+    size_t heldFdBudget;
+
+    static int openDirectoryAt(int parentFd, const char* name) {
+        return openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+
+    // Helper function to close the outermost ancestor fd still held
+    static bool closeOldestAncestor(vector<Frame>& stack, size_t& held) {
+        for (size_t i = 0; i + 1 < stack.size(); i++) {
+            if (stack[i].fd >= 0) {
+                close(stack[i].fd);
+                stack[i].fd = -1;
+                stack[i].reader.reset();
+                held--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Helper function to remove one non-directory entry; a d_type that
+    // turns out to be stale (EISDIR) is reported back as a directory
+    static bool unlinkEntry(int dirFd, const char* name, bool& isDir) {
+        Profiler::instance().count(COUNTER_UNLINK_CALLS);
+        if (unlinkat(dirFd, name, 0) == 0) return true;
+        isDir = (errno == EISDIR || errno == EPERM);
+        return false;
+    }
+
+    static bool removeEmptyDirectory(int dirFd, const char* name) {
+        Profiler::instance().count(COUNTER_UNLINK_CALLS);
+        return unlinkat(dirFd, name, AT_REMOVEDIR) == 0;
+    }
+
+    // Serial iterative removal of 'name' inside parentFd
+    bool removeSerial(int parentFd, const string& rootName) {
+        vector<Frame> stack;
+        size_t held = 0;
+
+        stack.push_back(Frame());
+        stack.back().name = rootName;
+        stack.back().fd = openDirectoryAt(parentFd, rootName.c_str());
+        if (stack.back().fd < 0) return false;
+        held++;
+
+        for (;;) {
+            Frame& top = stack.back();
+            if (!top.reader) top.reader.reset(new DirReader(top.fd));
+
+            const char* name;
+            unsigned char type;
+            if (top.reader->next(name, type)) {
+                if (isDotOrDotDot(name)) continue;
+                if (!top.failedNames.empty() && top.failedNames.count(name)) continue;
+
+                if (type == DT_UNKNOWN) {
+                    struct stat entryStat;
+                    if (countedStat(top.fd, name, &entryStat, AT_SYMLINK_NOFOLLOW) == 0) {
+                        type = S_ISDIR(entryStat.st_mode) ? DT_DIR : DT_REG;
+                    }
+                }
+                bool isDir = type == DT_DIR;
+                if (!isDir && unlinkEntry(top.fd, name, isDir)) continue;
+                if (!isDir) {
+                    top.failed = true;
+                    top.failedNames.insert(name);
+                    continue;
+                }
+
+                // Descend, staying within the fd budget
+                if (held >= heldFdBudget) closeOldestAncestor(stack, held);
+                int childFd = openDirectoryAt(top.fd, name);
+                while (childFd < 0 && (errno == EMFILE || errno == ENFILE)
+                       && closeOldestAncestor(stack, held)) {
+                    childFd = openDirectoryAt(top.fd, name);
+                }
+                struct stat dirStat;
+                if (childFd < 0 || countedStat(childFd, "", &dirStat, AT_EMPTY_PATH) != 0) {
+                    if (childFd >= 0) close(childFd);
+                    top.failed = true;
+                    top.failedNames.insert(name);
+                    continue;
+                }
+                // Identity of the parent, checked if it has to be reopened
+                if (top.dev == 0 && top.ino == 0) {
+                    struct stat parentStat;
+                    if (countedStat(top.fd, "", &parentStat, AT_EMPTY_PATH) == 0) {
+                        top.dev = parentStat.st_dev;
+                        top.ino = parentStat.st_ino;
+                    }
+                }
+                Frame child;
+                child.fd = childFd;
+                child.name = name;
+                child.dev = dirStat.st_dev;
+                child.ino = dirStat.st_ino;
+                stack.push_back(move(child));
+                held++;
+                continue;
+            }
+
+            // Directory exhausted: remove it from its parent
+            bool ok = top.reader->error() == 0 && !top.failed;
+            if (stack.size() == 1) {
+                close(top.fd);
+                return ok && removeEmptyDirectory(parentFd, rootName.c_str());
+            }
+
+            Frame& parent = stack[stack.size() - 2];
+            if (parent.fd < 0) {
+                int parentFdReopened = openat(top.fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                struct stat parentStat;
+                if (parentFdReopened < 0 || countedStat(parentFdReopened, "", &parentStat, AT_EMPTY_PATH) != 0
+                    || parentStat.st_dev != parent.dev || parentStat.st_ino != parent.ino) {
+                    // The tree was moved while we were inside it; give up
+                    // rather than delete from the wrong place
+                    if (parentFdReopened >= 0) close(parentFdReopened);
+                    for (auto& frame : stack) {
+                        if (frame.fd >= 0) close(frame.fd);
+                    }
+                    return false;
+                }
+                parent.fd = parentFdReopened;
+                held++;
+            }
+            close(top.fd);
+            held--;
+
+            string childName = move(top.name);
+            stack.pop_back();
+            Frame& owner = stack.back();
+            if (!ok || !removeEmptyDirectory(owner.fd, childName.c_str())) {
+                owner.failed = true;
+                owner.failedNames.insert(childName);
+            }
+        }
+    }
+
+    // Remove 'name' inside parentFd, fanning subdirectories out to the pool
+    // while depth < PARALLEL_DEPTH
+    bool removeAt(int parentFd, const string& name, int depth) {
+        if (pool == NULL || pool->size() < 2 || depth >= PARALLEL_DEPTH) {
+            return removeSerial(parentFd, name);
+        }
+
+        int dirFd = openDirectoryAt(parentFd, name.c_str());
+        if (dirFd < 0) return false;
+
+        atomic<bool> ok(true);
+        WorkerPool::TaskGroup group;
+        DirReader reader(dirFd);
+        const char* entryName;
+        unsigned char type;
+        while (reader.next(entryName, type)) {
+            if (isDotOrDotDot(entryName)) continue;
+            if (type == DT_UNKNOWN) {
+                struct stat entryStat;
+                if (countedStat(dirFd, entryName, &entryStat, AT_SYMLINK_NOFOLLOW) == 0) {
+                    type = S_ISDIR(entryStat.st_mode) ? DT_DIR : DT_REG;
+                }
+            }
+            bool isDir = type == DT_DIR;
+            if (!isDir && unlinkEntry(dirFd, entryName, isDir)) continue;
+            if (!isDir) {
+                ok = false;
+                continue;
+            }
+            string child = entryName;
+            pool->submit(group, [this, dirFd, child, depth, &ok]() {
+                if (!removeAt(dirFd, child, depth + 1)) ok = false;
+            });
+        }
+        if (reader.error() != 0) ok = false;
+        pool->wait(group);
+        close(dirFd);
+
+        return ok && removeEmptyDirectory(parentFd, name.c_str());
+    }
+
+public:
+    explicit TreeRemover(WorkerPool* workerPool) : pool(workerPool) {
+        // Share the fd limit between all threads, leaving headroom for the
+        // rest of the process
+        struct rlimit limit;
+        size_t available = 1024;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+            available = static_cast<size_t>(limit.rlim_cur);
+        }
+        size_t threads = pool ? pool->size() : 1;
+        size_t budget = available > 128 ? (available - 128) / (3 * threads) : 4;
+        heldFdBudget = min<size_t>(max<size_t>(budget, 4), 64);
+    }
+
+    // Remove the directory 'name' inside the directory parentFd and
+    // everything below it
+    bool remove(int parentFd, const string& name) {
+        return removeAt(parentFd, name, 0);
+    }
+};
+
+// Space used by a directory tree
+struct DiskUsageTotals {
+    unsigned long long apparentBytes;   // sum of st_size
+    unsigned long long allocatedBytes;  // sum of st_blocks * 512
+    size_t files;
+    size_t directories;
+
+    DiskUsageTotals() : apparentBytes(0), allocatedBytes(0), files(0), directories(0) {}
+
+    void add(const DiskUsageTotals& other) {
+        apparentBytes += other.apparentBytes;
+        allocatedBytes += other.allocatedBytes;
+        files += other.files;
+        directories += other.directories;
+    }
+};
+
+struct DiskUsageReport {
+    DiskUsageTotals total;
+    vector<pair<string, DiskUsageTotals>> children;  // subdirectories of the root
+    size_t scannedDirectories;
+    size_t cachedDirectories;
+    size_t hardLinksSkipped;
+    double seconds;
+    vector<pair<string, string>> errors;  // path, reason
+
+    DiskUsageReport() : scannedDirectories(0), cachedDirectories(0), hardLinksSkipped(0), seconds(0) {}
+};
+
+// Helper class that measures disk usage (du) of directory trees on a
+// WorkerPool. Symlinks are not followed and files with several hard links
+// are counted once per measurement, by device and inode.
+//
+// Every directory measured leaves a record in a cache: its own entries'
+// totals and the names of its subdirectories. A record is reused while
+// the directory's device, inode and mtime are unchanged (adding, removing
+// or renaming an entry updates the mtime) and it is younger than maxAge,
+// which bounds how long files growing in place go unnoticed. Reusing a
+// record still visits every subdirectory, but costs one lstat() per
+// directory instead of reading it, so asking again about a child of a
+// tree already measured is almost free.
+class DiskUsageScanner {
+public:
+    // Subdirectories are measured inline once the pool has this many
+    // queued tasks per thread
+    static const size_t MAX_QUEUED_PER_THREAD = 64;
+    static const size_t MAX_CACHED_DIRECTORIES = 1 << 20;
+
+private:
+    struct LinkedFile {
+        dev_t dev;
+        ino_t ino;
+        unsigned long long apparentBytes;
+        unsigned long long allocatedBytes;
+    };
+
+    struct DirRecord {
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtime;
+        chrono::steady_clock::time_point scannedAt;
+        DiskUsageTotals own;        // the directory itself and its other entries
+        vector<LinkedFile> links;   // entries with more than one link, not in 'own'
+        vector<string> children;    // subdirectory names
+    };
+
+    mutex cacheMutex;
+    unordered_map<string, DirRecord> cache;
+    chrono::seconds maxAge;
+
+    // State of the running measurement
+    WorkerPool* pool;
+    mutex linkMutex;
+    set<pair<dev_t, ino_t>> seenLinks;
+    mutex errorMutex;
+    vector<pair<string, string>> errors;
+    atomic<size_t> scanned;
+    atomic<size_t> reused;
+    atomic<size_t> linksSkipped;
+
+    static string joinPath(const string& dir, const string& name) {
+        return dir == "/" ? "/" + name : dir + "/" + name;
+    }
+
+    static void addStat(DiskUsageTotals& totals, const struct stat& st) {
+        totals.apparentBytes += st.st_size;
+        totals.allocatedBytes += static_cast<unsigned long long>(st.st_blocks) * 512;
+        if (S_ISDIR(st.st_mode)) totals.directories++;
+        else totals.files++;
+    }
+
+    void recordError(const string& path, int error) {
+        lock_guard<mutex> lock(errorMutex);
+        errors.push_back(make_pair(path, strerror(error)));
+    }
+
+    bool lookup(const string& path, const struct stat& dirStat, DirRecord& record) {
+        lock_guard<mutex> lock(cacheMutex);
+        auto it = cache.find(path);
+        if (it == cache.end()) return false;
+        const DirRecord& cached = it->second;
+        if (cached.dev != dirStat.st_dev || cached.ino != dirStat.st_ino
+            || cached.mtime.tv_sec != dirStat.st_mtim.tv_sec
+            || cached.mtime.tv_nsec != dirStat.st_mtim.tv_nsec
+            || chrono::steady_clock::now() - cached.scannedAt > maxAge) {
+            cache.erase(it);
+            return false;
+        }
+        record = cached;
+        return true;
+    }
+
+    void store(const string& path, const DirRecord& record) {
+        lock_guard<mutex> lock(cacheMutex);
+        if (cache.size() < MAX_CACHED_DIRECTORIES || cache.count(path)) {
+            cache[path] = record;
+        }
+    }
+
+    // Reads one directory into 'record'; every non-directory entry is
+    // lstat'ed relative to the directory fd
+    bool scanDirectory(const string& path, const struct stat& dirStat, DirRecord& record) {
+        TreeDirectory dir(path);
+        if (!dir.isOpen()) {
+            recordError(path, dir.openError());
+            return false;
+        }
+        record.dev = dirStat.st_dev;
+        record.ino = dirStat.st_ino;
+        record.mtime = dirStat.st_mtim;
+        record.scannedAt = chrono::steady_clock::now();
+        addStat(record.own, dirStat);
+
+        const char* name;
+        unsigned char type;
+        while (dir.next(name, type)) {
+            if (type == DT_DIR) {
+                record.children.push_back(name);
+                continue;
+            }
+            const struct stat* st = dir.entryStat();
+            if (st == NULL) {
+                recordError(joinPath(path, name), dir.statError());
+            } else if (S_ISDIR(st->st_mode)) {
+                // Replaced by a directory since it was read
+                record.children.push_back(name);
+            } else if (st->st_nlink > 1) {
+                LinkedFile link;
+                link.dev = st->st_dev;
+                link.ino = st->st_ino;
+                link.apparentBytes = st->st_size;
+                link.allocatedBytes = static_cast<unsigned long long>(st->st_blocks) * 512;
+                record.links.push_back(link);
+            } else {
+                addStat(record.own, *st);
+            }
+        }
+        if (dir.readError() != 0) {
+            recordError(path, dir.readError());
+            return false;
+        }
+        return true;
+    }
+
+    // Adds each multiply-linked file the first time this measurement sees it
+    void addLinks(const vector<LinkedFile>& links, DiskUsageTotals& totals) {
+        if (links.empty()) return;
+        lock_guard<mutex> lock(linkMutex);
+        for (const auto& link : links) {
+            if (seenLinks.insert(make_pair(link.dev, link.ino)).second) {
+                totals.apparentBytes += link.apparentBytes;
+                totals.allocatedBytes += link.allocatedBytes;
+                totals.files++;
+            } else {
+                linksSkipped++;
+            }
+        }
+    }
+
+    DiskUsageTotals measureDirectory(const string& path, vector<pair<string, DiskUsageTotals>>* childTotals) {
+        DiskUsageTotals total;
+        struct stat dirStat;
+        if (countedStat(AT_FDCWD, path.c_str(), &dirStat, AT_SYMLINK_NOFOLLOW) != 0) {
+            recordError(path, errno);
+            return total;
+        }
+        if (!S_ISDIR(dirStat.st_mode)) {
+            addStat(total, dirStat);
+            return total;
+        }
+
+        DirRecord record;
+        bool complete = true;
+        if (lookup(path, dirStat, record)) {
+            reused++;
+        } else {
+            record = DirRecord();
+            complete = scanDirectory(path, dirStat, record);
+            scanned++;
+            if (record.own.directories == 0) addStat(record.own, dirStat);
+        }
+        total = record.own;
+        addLinks(record.links, total);
+
+        // Subdirectories fan out over the pool while it has room
+        vector<DiskUsageTotals> results(record.children.size());
+        WorkerPool::TaskGroup group;
+        for (size_t i = 0; i < record.children.size(); i++) {
+            string childPath = joinPath(path, record.children[i]);
+            DiskUsageTotals* result = &results[i];
+            if (pool != NULL && pool->size() > 1
+                && pool->pending() < MAX_QUEUED_PER_THREAD * pool->size()) {
+                pool->submit(group, [this, childPath, result]() {
+                    *result = measureDirectory(childPath, NULL);
+                });
+            } else {
+                *result = measureDirectory(childPath, NULL);
+            }
+        }
+        if (pool != NULL) pool->wait(group);
+
+        for (size_t i = 0; i < results.size(); i++) {
+            total.add(results[i]);
+            if (childTotals != NULL) {
+                childTotals->push_back(make_pair(record.children[i], results[i]));
+            }
+        }
+        // Partially read directories are measured but never cached
+        if (complete) store(path, record);
+        return total;
+    }
+
+public:
+    DiskUsageScanner() : maxAge(60), pool(NULL), scanned(0), reused(0), linksSkipped(0) {}
+
+    void setMaxAge(chrono::seconds age) {
+        maxAge = age;
+    }
+
+    size_t cachedDirectories() {
+        lock_guard<mutex> lock(cacheMutex);
+        return cache.size();
+    }
+
+    void clearCache() {
+        lock_guard<mutex> lock(cacheMutex);
+        cache.clear();
+    }
+
+    // Measures 'path' (absolute, canonical, so cache keys are stable)
+    DiskUsageReport measure(const string& path, WorkerPool* workerPool) {
+        DiskUsageReport report;
+        auto start = chrono::steady_clock::now();
+        pool = workerPool;
+        seenLinks.clear();
+        errors.clear();
+        scanned = reused = linksSkipped = 0;
+
+        report.total = measureDirectory(path, &report.children);
+
+        pool = NULL;
+        seenLinks.clear();
+        report.scannedDirectories = scanned.load();
+        report.cachedDirectories = reused.load();
+        report.hardLinksSkipped = linksSkipped.load();
+        report.errors.swap(errors);
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+};
+
+#ifdef FILE_EXPLORER_HAVE_IO_URING
+// Minimal io_uring instance driven through the raw syscalls (no liburing):
+// one submission and one completion ring plus the SQE array, all mmap'ed
+// from the ring fd. Used only from the thread that created it.
+class IoUring {
+private:
+    int ringFd;
+    unsigned entries;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    io_uring_cqe* cqes;
+    unsigned unsubmitted;
+    vector<bool> supportedOps;
+
+    void probe() {
+        size_t size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+        vector<char> buffer(size, 0);
+        io_uring_probe* result = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, result, 256) < 0) return;
+        for (unsigned i = 0; i < result->ops_len && i < 256; i++) {
+            if (result->ops[i].flags & IO_URING_OP_SUPPORTED) supportedOps[result->ops[i].op] = true;
+        }
+    }
+
+public:
+    explicit IoUring(unsigned depth)
+        : ringFd(-1), entries(0), sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED), cqRingSize(0),
+          sqes(NULL), sqesSize(0), unsubmitted(0), supportedOps(256, false) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (fd < 0) return;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            close(fd);
+            return;
+        }
+        cqRing = single ? sqRing
+                        : mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                               IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqeMap = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (cqRing == MAP_FAILED || sqeMap == MAP_FAILED) {
+            if (sqeMap != MAP_FAILED) munmap(sqeMap, sqesSize);
+            if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+            munmap(sqRing, sqRingSize);
+            sqRing = cqRing = MAP_FAILED;
+            close(fd);
+            return;
+        }
+        sqes = static_cast<io_uring_sqe*>(sqeMap);
+
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        entries = params.sq_entries;
+        ringFd = fd;
+        probe();
+    }
+
+    ~IoUring() {
+        if (sqes != NULL) munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (ringFd >= 0) close(ringFd);
+    }
+
+    bool isReady() const {
+        return ringFd >= 0;
+    }
+
+    bool supports(unsigned char opcode) const {
+        return ringFd >= 0 && supportedOps[opcode];
+    }
+
+    unsigned depth() const {
+        return entries;
+    }
+
+    // Next free SQE (zeroed), or NULL while the submission ring is full
+    io_uring_sqe* nextSqe() {
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        unsigned tail = *sqTail;
+        if (tail - head >= entries) return NULL;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+        return sqe;
+    }
+
+    // Submits the queued SQEs and waits for at least 'waitFor' completions
+    bool submit(unsigned waitFor) {
+        for (;;) {
+            long n = syscall(__NR_io_uring_enter, ringFd, unsubmitted, waitFor,
+                             waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+            if (n >= 0) {
+                unsubmitted -= static_cast<unsigned>(n);
+                return true;
+            }
+            if (errno != EINTR) return false;
+        }
+    }
+
+    // Waits for 'count' completions without submitting anything new
+    bool waitForCompletions(unsigned count) {
+        for (;;) {
+            long n = syscall(__NR_io_uring_enter, ringFd, 0, count, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (n >= 0) return true;
+            if (errno != EINTR) return false;
+        }
+    }
+
+    // Queued SQEs the kernel has not consumed yet; they are the most
+    // recently queued ones, since the kernel consumes the ring in order
+    unsigned unsubmittedCount() const {
+        return unsubmitted;
+    }
+
+    // Calls fn(user_data, res) for every completion available; returns the count
+    template <typename Function>
+    unsigned reap(Function fn) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; head++, count++) {
+            const io_uring_cqe& cqe = cqes[head & *cqMask];
+            fn(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+};
+#endif
+
+enum BatchOperation { BATCH_CREATE, BATCH_MKDIR, BATCH_DELETE, BATCH_RENAME, BATCH_CHMOD, BATCH_CHOWN };
+
+// One name a batch operation applies to
+struct BatchItem {
+    string name;        // relative to the batch directory
+    string target;      // BATCH_RENAME: new name
+    bool isDirectory;   // BATCH_DELETE: found to be a directory
+    int error;          // errno of the failed step, 0 on success, -1 not run yet,
+                        // OUTCOME_UNKNOWN if it was submitted but never completed
+
+    static const int OUTCOME_UNKNOWN = -2;
+};
+
+struct BatchReport {
+    size_t succeeded;
+    size_t failed;
+    double seconds;
+    const char* engine;
+
+    BatchReport() : succeeded(0), failed(0), seconds(0), engine("") {}
+};
+
+// Helper class that applies one operation to many names in a directory.
+// create/mkdir/delete/rename are queued on io_uring (openat, mkdirat,
+// statx + unlinkat, renameat) when the kernel supports the opcodes, with
+// up to a ring's worth in flight; otherwise, and always for chmod/chown
+// (io_uring has no such opcodes), the plain syscalls run on the worker
+// pool. Each item records its own errno, so one failure never stops the
+// rest of the batch.
+class BatchRunner {
+public:
+    static const unsigned RING_DEPTH = 256;
+
+private:
+    int dirFd;
+    WorkerPool* pool;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    bool recursive;
+
+    static int errorOf(int result) {
+        return result == 0 ? 0 : errno;
+    }
+
+    // The synchronous version of each operation, used by the pool path and
+    // for steps io_uring cannot do
+    int applyOne(BatchOperation operation, BatchItem& item) {
+        switch (operation) {
+        case BATCH_CREATE: {
+            int fd = openat(dirFd, item.name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+            if (fd < 0) return errno;
+            close(fd);
+            return 0;
+        }
+        case BATCH_MKDIR:
+            return errorOf(mkdirat(dirFd, item.name.c_str(), 0755));
+        case BATCH_DELETE: {
+            struct stat st;
+            if (countedStat(dirFd, item.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) return errno;
+            item.isDirectory = S_ISDIR(st.st_mode);
+            if (unlinkat(dirFd, item.name.c_str(), item.isDirectory ? AT_REMOVEDIR : 0) == 0) return 0;
+            return removeNonEmpty(item, errno);
+        }
+        case BATCH_RENAME:
+            // Never replace an existing entry, like renameItem
+            if (syscall(SYS_renameat2, dirFd, item.name.c_str(), dirFd, item.target.c_str(),
+                        RENAME_NOREPLACE) == 0) {
+                return 0;
+            }
+            if (errno != EINVAL && errno != ENOSYS) return errno;
+            if (faccessat(dirFd, item.target.c_str(), F_OK, AT_SYMLINK_NOFOLLOW) == 0) return EEXIST;
+            return errorOf(renameat(dirFd, item.name.c_str(), dirFd, item.target.c_str()));
+        case BATCH_CHMOD:
+            return errorOf(fchmodat(dirFd, item.name.c_str(), mode, 0));
+        case BATCH_CHOWN:
+            return errorOf(fchownat(dirFd, item.name.c_str(), uid, gid, 0));
+        }
+        return EINVAL;
+    }
+
+    // A directory that rmdir refused because it has entries is removed
+    // with TreeRemover when the batch is recursive
+    int removeNonEmpty(const BatchItem& item, int error) {
+        if (!item.isDirectory || (error != ENOTEMPTY && error != EEXIST) || !recursive) return error;
+        TreeRemover remover(pool);
+        return remover.remove(dirFd, item.name) ? 0 : (errno ? errno : EIO);
+    }
+
+    // Runs every item not yet handled (error -1) with the plain syscalls
+    void runOnPool(BatchOperation operation, vector<BatchItem>& items) {
+        auto applyAt = [&](size_t i) {
+            if (items[i].error == -1) items[i].error = applyOne(operation, items[i]);
+        };
+        if (pool != NULL && pool->size() > 1) {
+            pool->parallelFor(items.size(), applyAt, 16);
+        } else {
+            for (size_t i = 0; i < items.size(); i++) applyAt(i);
+        }
+    }
+
+#ifdef FILE_EXPLORER_HAVE_IO_URING
+    // Runs prepare(sqe, i) for every index in 'indices' with at most a
+    // ring's depth of requests in flight; complete(i, res) sees each result.
+    // If submitting fails, requests already in the kernel are waited for;
+    // items whose outcome still cannot be known are marked OUTCOME_UNKNOWN
+    // so the pool fallback does not run them a second time. Items never
+    // submitted stay pending.
+    template <typename Prepare, typename Complete>
+    bool drive(IoUring& ring, vector<BatchItem>& items, const vector<size_t>& indices, Prepare prepare,
+               Complete complete) {
+        vector<char> flying(items.size(), 0);
+        auto onCompletion = [&](uint64_t index, int result) {
+            flying[index] = 0;
+            complete(static_cast<size_t>(index), result);
+        };
+        size_t next = 0, inFlight = 0;
+        while (next < indices.size() || inFlight > 0) {
+            io_uring_sqe* sqe;
+            while (next < indices.size() && inFlight < ring.depth() && (sqe = ring.nextSqe()) != NULL) {
+                prepare(sqe, indices[next]);
+                sqe->user_data = indices[next];
+                flying[indices[next]] = 1;
+                next++;
+                inFlight++;
+            }
+            if (!ring.submit(1)) {
+                unsigned unsent = ring.unsubmittedCount();
+                for (size_t i = next - unsent; i < next; i++) flying[indices[i]] = 0;
+                for (size_t outstanding = inFlight - unsent; outstanding > 0;) {
+                    if (!ring.waitForCompletions(1)) break;
+                    outstanding -= min<size_t>(outstanding, ring.reap(onCompletion));
+                }
+                for (size_t i = 0; i < items.size(); i++) {
+                    if (flying[i]) items[i].error = BatchItem::OUTCOME_UNKNOWN;
+                }
+                return false;
+            }
+            inFlight -= ring.reap(onCompletion);
+        }
+        return true;
+    }
+
+    bool runIoUring(BatchOperation operation, vector<BatchItem>& items) {
+        unsigned char opcode = 0;
+        switch (operation) {
+        case BATCH_CREATE: opcode = IORING_OP_OPENAT; break;
+        case BATCH_MKDIR: opcode = IORING_OP_MKDIRAT; break;
+        case BATCH_DELETE: opcode = IORING_OP_UNLINKAT; break;
+        case BATCH_RENAME: opcode = IORING_OP_RENAMEAT; break;
+        default: return false;
+        }
+        IoUring ring(RING_DEPTH);
+        if (!ring.supports(opcode) || (operation == BATCH_DELETE && !ring.supports(IORING_OP_STATX))) {
+            return false;
+        }
+
+        vector<size_t> all(items.size());
+        for (size_t i = 0; i < all.size(); i++) all[i] = i;
+        int fd = dirFd;
+        bool ok = true;
+
+        switch (operation) {
+        case BATCH_CREATE:
+            ok = drive(ring, items, all, [&](io_uring_sqe* sqe, size_t i) {
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(items[i].name.c_str());
+                sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+                sqe->len = 0666;
+            }, [&](size_t i, int result) {
+                if (result >= 0) close(result);
+                items[i].error = result < 0 ? -result : 0;
+            });
+            break;
+        case BATCH_MKDIR:
+            ok = drive(ring, items, all, [&](io_uring_sqe* sqe, size_t i) {
+                sqe->opcode = IORING_OP_MKDIRAT;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(items[i].name.c_str());
+                sqe->len = 0755;
+            }, [&](size_t i, int result) {
+                items[i].error = result < 0 ? -result : 0;
+            });
+            break;
+        case BATCH_RENAME:
+            ok = drive(ring, items, all, [&](io_uring_sqe* sqe, size_t i) {
+                sqe->opcode = IORING_OP_RENAMEAT;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(items[i].name.c_str());
+                sqe->len = static_cast<uint32_t>(fd);
+                sqe->addr2 = reinterpret_cast<uint64_t>(items[i].target.c_str());
+                sqe->rename_flags = RENAME_NOREPLACE;
+            }, [&](size_t i, int result) {
+                items[i].error = result < 0 ? -result : 0;
+            });
+            // Filesystems without RENAME_NOREPLACE take the checked path
+            for (auto& item : items) {
+                if (item.error == EINVAL) item.error = applyOne(BATCH_RENAME, item);
+            }
+            break;
+        default: {
+            // statx tells files from directories, then unlinkat removes both.
+            // Items stay pending (-1) until their unlinkat completes.
+            vector<struct statx> info(items.size());
+            vector<size_t> found;
+            ok = drive(ring, items, all, [&](io_uring_sqe* sqe, size_t i) {
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(items[i].name.c_str());
+                sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+                sqe->len = STATX_TYPE;
+                sqe->off = reinterpret_cast<uint64_t>(&info[i]);
+            }, [&](size_t i, int result) {
+                if (result < 0) items[i].error = -result;
+                else found.push_back(i);
+                items[i].isDirectory = result == 0 && S_ISDIR(info[i].stx_mode);
+            });
+            vector<size_t> nonEmpty;
+            ok = ok && drive(ring, items, found, [&](io_uring_sqe* sqe, size_t i) {
+                sqe->opcode = IORING_OP_UNLINKAT;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(items[i].name.c_str());
+                sqe->unlink_flags = items[i].isDirectory ? AT_REMOVEDIR : 0;
+            }, [&](size_t i, int result) {
+                items[i].error = result < 0 ? -result : 0;
+                if (items[i].error != 0 && items[i].isDirectory) nonEmpty.push_back(i);
+            });
+            for (size_t i : nonEmpty) {
+                items[i].error = removeNonEmpty(items[i], items[i].error);
+            }
+            break;
+        }
+        }
+        return ok;
+    }
+#endif
+
+public:
+    BatchRunner(int directoryFd, WorkerPool* workerPool)
+        : dirFd(directoryFd), pool(workerPool), mode(0644), uid(static_cast<uid_t>(-1)),
+          gid(static_cast<gid_t>(-1)), recursive(false) {}
+
+    void setMode(mode_t newMode) { mode = newMode; }
+    void setOwner(uid_t newUid, gid_t newGid) { uid = newUid; gid = newGid; }
+    void setRecursive(bool enabled) { recursive = enabled; }
+
+    BatchReport run(BatchOperation operation, vector<BatchItem>& items) {
+        ScopedPhase timer(PHASE_BATCH);
+        BatchReport report;
+        auto start = chrono::steady_clock::now();
+        for (auto& item : items) {
+            item.error = -1;
+            item.isDirectory = false;
+        }
+
+        report.engine = "thread pool";
+#ifdef FILE_EXPLORER_HAVE_IO_URING
+        // A ring that fails part way leaves the rest pending for the pool
+        if (runIoUring(operation, items)) report.engine = "io_uring";
+#endif
+        runOnPool(operation, items);
+
+        for (const auto& item : items) {
+            if (item.error == 0) report.succeeded++;
+            else report.failed++;
+        }
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+};
+
+// Case-insensitive (ASCII) filename matcher used by search. The pattern is
+// folded once up front; names are matched in place, straight from dirent
+// or index buffers, without allocating. Substring search uses a SIMD
+// kernel chosen at startup (AVX2, else SSE2, else scalar): it compares
+// the first and last needle bytes across a whole vector of positions and
+// only verifies the candidates.
+class NameMatcher {
+public:
+    enum Mode { MATCH_SUBSTRING, MATCH_PREFIX, MATCH_SUFFIX, MATCH_GLOB };
+
+    // Returns the first match of the folded needle in haystack, or NULL
+    typedef const char* (*FindFunction)(const char* haystack, size_t length, const char* needle,
+                                        size_t needleLength);
+
+private:
+    string pattern;  // folded
+    Mode mode;
+
+    static unsigned char fold(unsigned char c) {
+        return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+    }
+
+    // Compare 'length' bytes of s (folded on the fly) against folded
+    static bool equalFolded(const char* s, const char* folded, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            if (fold(static_cast<unsigned char>(s[i])) != static_cast<unsigned char>(folded[i])) return false;
+        }
+        return true;
+    }
+
+    static const char* findScalar(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+        if (needleLength == 0) return haystack;
+        if (needleLength > length) return NULL;
+        unsigned char first = static_cast<unsigned char>(needle[0]);
+        for (size_t i = 0; i + needleLength <= length; i++) {
+            if (fold(static_cast<unsigned char>(haystack[i])) == first
+                && equalFolded(haystack + i + 1, needle + 1, needleLength - 1)) {
+                return haystack + i;
+            }
+        }
+        return NULL;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    static __m128i fold128(__m128i bytes) {
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), bytes));
+        return _mm_add_epi8(bytes, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+    }
+
+    static const char* findSse2(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+        if (needleLength == 0) return haystack;
+        if (needleLength > length) return NULL;
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+        size_t i = 0;
+        for (; i + needleLength - 1 + 16 <= length; i += 16) {
+            __m128i blockFirst = fold128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i)));
+            __m128i blockLast = fold128(_mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(haystack + i + needleLength - 1)));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last))));
+            while (mask != 0) {
+                size_t at = i + __builtin_ctz(mask);
+                if (needleLength <= 2 || equalFolded(haystack + at + 1, needle + 1, needleLength - 2)) {
+                    return haystack + at;
+                }
+                mask &= mask - 1;
+            }
+        }
+        return findScalar(haystack + i, length - i, needle, needleLength);
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i fold256(__m256i bytes) {
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('A' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), bytes));
+        return _mm256_add_epi8(bytes, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A')));
+    }
+
+    __attribute__((target("avx2")))
+    static const char* findAvx2(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+        if (needleLength == 0) return haystack;
+        if (needleLength > length) return NULL;
+        const __m256i first = _mm256_set1_epi8(needle[0]);
+        const __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+        size_t i = 0;
+        for (; i + needleLength - 1 + 32 <= length; i += 32) {
+            __m256i blockFirst = fold256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i)));
+            __m256i blockLast = fold256(_mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(haystack + i + needleLength - 1)));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first), _mm256_cmpeq_epi8(blockLast, last))));
+            while (mask != 0) {
+                size_t at = i + __builtin_ctz(mask);
+                if (needleLength <= 2 || equalFolded(haystack + at + 1, needle + 1, needleLength - 2)) {
+                    return haystack + at;
+                }
+                mask &= mask - 1;
+            }
+        }
+        // Names are usually shorter than a vector; finish with SSE2
+        return findSse2(haystack + i, length - i, needle, needleLength);
+    }
+#endif
+
+    static FindFunction& activeKernel() {
+        static FindFunction kernel = detectKernel();
+        return kernel;
+    }
+
+    static FindFunction detectKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return findAvx2;
+        if (__builtin_cpu_supports("sse2")) return findSse2;
+#endif
+        return findScalar;
+    }
+
+    // Glob match of a name against the folded pattern: '*', '?' and
+    // bracket classes ("[a-z]", "[!0-9]"); a '[' without ']' is literal
+    bool globMatch(const char* name, size_t length) const {
+        const char* p = pattern.data();
+        const char* patternEnd = p + pattern.size();
+        size_t i = 0;
+        const char* starPattern = NULL;
+        size_t starName = 0;
+
+        while (i < length) {
+            unsigned char c = fold(static_cast<unsigned char>(name[i]));
+            if (p < patternEnd && *p == '*') {
+                starPattern = ++p;
+                starName = i;
+                continue;
+            }
+            // An unterminated '[' is a literal character, as in fnmatch
+            bool bracket = false;
+            if (p < patternEnd && *p == '[') {
+                const char* q = p + 1;
+                bool negate = q < patternEnd && (*q == '!' || *q == '^');
+                if (negate) q++;
+                bool matched = false;
+                bool first = true;
+                while (q < patternEnd && (first || *q != ']')) {
+                    unsigned char low = static_cast<unsigned char>(*q);
+                    unsigned char high = low;
+                    if (q + 2 < patternEnd && q[1] == '-' && q[2] != ']') {
+                        high = static_cast<unsigned char>(q[2]);
+                        q += 2;
+                    }
+                    if (c >= low && c <= high) matched = true;
+                    q++;
+                    first = false;
+                }
+                bracket = q < patternEnd;
+                if (bracket && matched != negate) {
+                    p = q + 1;
+                    i++;
+                    continue;
+                }
+            }
+            if (!bracket && p < patternEnd && (*p == '?' || static_cast<unsigned char>(*p) == c)) {
+                p++;
+                i++;
+                continue;
+            }
+            // Mismatch: let the last '*' absorb one more character
+            if (starPattern == NULL) return false;
+            p = starPattern;
+            i = ++starName;
+        }
+        while (p < patternEnd && *p == '*') p++;
+        return p == patternEnd;
+    }
+
+public:
+    NameMatcher(const string& text, Mode matchMode) : pattern(text), mode(matchMode) {
+        for (auto& c : pattern) {
+            c = static_cast<char>(fold(static_cast<unsigned char>(c)));
+        }
+    }
+
+    // Matcher for a user-typed search term: "glob:file?.c" is a glob and
+    // "lit:^a[1]$" a plain substring, whatever they contain. Otherwise a
+    // term with '*' is a glob, "^abc" anchors at the start, "abc$" at the
+    // end, and anything else (including "foo[1]" or "what?") is a substring.
+    static NameMatcher fromSearchTerm(const string& term) {
+        if (term.compare(0, 5, "glob:") == 0) {
+            return NameMatcher(term.substr(5), MATCH_GLOB);
+        }
+        if (term.compare(0, 4, "lit:") == 0) {
+            return NameMatcher(term.substr(4), MATCH_SUBSTRING);
+        }
+        if (term.find('*') != string::npos) {
+            return NameMatcher(term, MATCH_GLOB);
+        }
+        if (term.size() > 1 && term[0] == '^') {
+            return NameMatcher(term.substr(1), MATCH_PREFIX);
+        }
+        if (term.size() > 1 && term[term.size() - 1] == '$') {
+            return NameMatcher(term.substr(0, term.size() - 1), MATCH_SUFFIX);
+        }
+        return NameMatcher(term, MATCH_SUBSTRING);
+    }
+
+    bool matches(const char* name, size_t length) const {
+        switch (mode) {
+        case MATCH_PREFIX:
+            return length >= pattern.size() && equalFolded(name, pattern.data(), pattern.size());
+        case MATCH_SUFFIX:
+            return length >= pattern.size()
+                && equalFolded(name + length - pattern.size(), pattern.data(), pattern.size());
+        case MATCH_GLOB:
+            return globMatch(name, length);
+        default:
+            return activeKernel()(name, length, pattern.data(), pattern.size()) != NULL;
+        }
+    }
+
+    // First case-insensitive occurrence of the pattern in text (any mode is
+    // treated as a plain substring here), or NULL
+    const char* find(const char* text, size_t length) const {
+        return activeKernel()(text, length, pattern.data(), pattern.size());
+    }
+
+    size_t patternLength() const {
+        return pattern.size();
+    }
+
+    bool matches(const char* name) const {
+        return matches(name, strlen(name));
+    }
+
+    // Name of the substring kernel in use
+    static const char* kernelName() {
+#if defined(__x86_64__) || defined(__i386__)
+        if (activeKernel() == findAvx2) return "avx2";
+        if (activeKernel() == findSse2) return "sse2";
+#endif
+        return "scalar";
+    }
+
+    // Force a kernel ("avx2", "sse2" or "scalar"), e.g. for benchmarks;
+    // false if the CPU does not support it
+    static bool selectKernel(const string& name) {
+        if (name == "scalar") {
+            activeKernel() = findScalar;
+            return true;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (name == "sse2" && __builtin_cpu_supports("sse2")) {
+            activeKernel() = findSse2;
+            return true;
+        }
+        if (name == "avx2" && __builtin_cpu_supports("avx2")) {
+            activeKernel() = findAvx2;
+            return true;
+        }
+#endif
+        return false;
+    }
+};
+
+// Sort keys, filters and an optional result limit for a directory listing.
+// A query is usually built from a spec string such as
+//   "sort=size reverse limit=100 type=f size>1M newer=1h name=*.log"
+// and then applied to a DirSnapshot: filters drop entries from the
+// snapshot's order, and the sort only orders the first 'limit' entries
+// when a limit is set.
+struct ListingQuery {
+    enum SortKey { SORT_NAME, SORT_SIZE, SORT_MTIME, SORT_EXTENSION, SORT_NATURAL };
+    enum TypeFilter { TYPE_ANY, TYPE_FILE, TYPE_DIRECTORY, TYPE_LINK };
+
+    SortKey sortKey;
+    bool reverse;
+    bool directoriesFirst;
+    TypeFilter type;
+    int64_t minSize;        // inclusive, -1 when unset
+    int64_t maxSize;        // inclusive, -1 when unset
+    int64_t newerThan;      // seconds before now, -1 when unset
+    int64_t olderThan;      // seconds before now, -1 when unset
+    string glob;            // case-insensitive, like the search terms
+    size_t limit;           // 0 = every entry
+
+    ListingQuery()
+        : sortKey(SORT_NAME), reverse(false), directoriesFirst(true), type(TYPE_ANY),
+          minSize(-1), maxSize(-1), newerThan(-1), olderThan(-1), limit(0) {}
+
+    // Size and time keys need stat records; names and d_type do not
+    bool needsStat() const {
+        return sortKey == SORT_SIZE || sortKey == SORT_MTIME || minSize >= 0 || maxSize >= 0
+            || newerThan >= 0 || olderThan >= 0;
+    }
+
+    bool isDefault() const {
+        return sortKey == SORT_NAME && !reverse && directoriesFirst && type == TYPE_ANY
+            && !needsStat() && glob.empty() && limit == 0;
+    }
+
+    // Compares names with digit runs ordered by value ("file2" < "file10")
+    static int naturalCompare(const char* a, const char* b) {
+        while (*a != '\0' && *b != '\0') {
+            if (isdigit(static_cast<unsigned char>(*a)) && isdigit(static_cast<unsigned char>(*b))) {
+                while (*a == '0') a++;
+                while (*b == '0') b++;
+                const char* endA = a;
+                const char* endB = b;
+                while (isdigit(static_cast<unsigned char>(*endA))) endA++;
+                while (isdigit(static_cast<unsigned char>(*endB))) endB++;
+                if (endA - a != endB - b) return (endA - a < endB - b) ? -1 : 1;
+                int c = memcmp(a, b, endA - a);
+                if (c != 0) return c;
+                a = endA;
+                b = endB;
+                continue;
+            }
+            if (*a != *b) return static_cast<unsigned char>(*a) < static_cast<unsigned char>(*b) ? -1 : 1;
+            a++;
+            b++;
+        }
+        return (*a != '\0') ? 1 : ((*b != '\0') ? -1 : 0);
+    }
+
+    // Text after the last '.', or "" (a leading dot does not count)
+    static const char* extensionOf(const char* name, size_t length) {
+        for (size_t i = length; i > 1; i--) {
+            if (name[i - 1] == '.') return name + i;
+        }
+        return name + length;
+    }
+
+    // Strict weak order over record indices of one snapshot; ties on the
+    // sort key fall back to the name so the order is total
+    class Less {
+        const DirSnapshot& snapshot;
+        const ListingQuery& query;
+
+        static int sign(int64_t a, int64_t b) {
+            return a < b ? -1 : (a > b ? 1 : 0);
+        }
+
+    public:
+        Less(const DirSnapshot& snap, const ListingQuery& q) : snapshot(snap), query(q) {}
+
+        bool operator()(uint32_t a, uint32_t b) const {
+            if (query.directoriesFirst) {
+                bool aDir = snapshot.isDirectory(a);
+                bool bDir = snapshot.isDirectory(b);
+                if (aDir != bDir) return aDir;
+            }
+            const DirSnapshot::Entry& ea = snapshot.record(a);
+            const DirSnapshot::Entry& eb = snapshot.record(b);
+            int c = 0;
+            switch (query.sortKey) {
+            case SORT_SIZE:
+                c = sign(ea.size, eb.size);
+                break;
+            case SORT_MTIME:
+                c = sign(ea.mtime, eb.mtime);
+                break;
+            case SORT_EXTENSION:
+                c = strcmp(extensionOf(snapshot.name(a), ea.nameLength),
+                           extensionOf(snapshot.name(b), eb.nameLength));
+                break;
+            case SORT_NATURAL:
+                c = naturalCompare(snapshot.name(a), snapshot.name(b));
+                break;
+            default:
+                break;
+            }
+            if (c == 0) c = strcmp(snapshot.name(a), snapshot.name(b));
+            return query.reverse ? c > 0 : c < 0;
+        }
+    };
+
+    // Drops filtered-out entries from the snapshot's order, then sorts it
+    // (on the pool for large directories) and cuts it to 'limit'
+    void apply(DirSnapshot& snapshot, WorkerPool* pool = NULL) const {
+        int64_t now = static_cast<int64_t>(time(NULL));
+        unique_ptr<NameMatcher> matcher;
+        if (!glob.empty()) matcher.reset(new NameMatcher(glob, NameMatcher::MATCH_GLOB));
+
+        snapshot.removeIf([&](uint32_t index) {
+            const DirSnapshot::Entry& entry = snapshot.record(index);
+            switch (type) {
+            case TYPE_FILE:
+                if (entry.type == DT_LNK || snapshot.isDirectory(index)) return true;
+                break;
+            case TYPE_DIRECTORY:
+                if (entry.type == DT_LNK || !snapshot.isDirectory(index)) return true;
+                break;
+            case TYPE_LINK:
+                if (entry.type != DT_LNK) return true;
+                break;
+            default:
+                break;
+            }
+            if (minSize >= 0 && entry.size < minSize) return true;
+            if (maxSize >= 0 && entry.size > maxSize) return true;
+            if (newerThan >= 0 && entry.mtime < now - newerThan) return true;
+            if (olderThan >= 0 && entry.mtime >= now - olderThan) return true;
+            return matcher && !matcher->matches(snapshot.name(index), entry.nameLength);
+        });
+        snapshot.sortBy(Less(snapshot, *this), limit, pool);
+    }
+
+    // "10", "4K", "1.5M", "2G" (binary units, optional trailing 'B')
+    static bool parseSize(const string& text, int64_t& bytes) {
+        char* end = NULL;
+        double value = strtod(text.c_str(), &end);
+        if (end == text.c_str() || value < 0) return false;
+        double scale = 1;
+        switch (toupper(static_cast<unsigned char>(*end))) {
+        case 'K': scale = 1024.0; end++; break;
+        case 'M': scale = 1024.0 * 1024; end++; break;
+        case 'G': scale = 1024.0 * 1024 * 1024; end++; break;
+        case 'T': scale = 1024.0 * 1024 * 1024 * 1024; end++; break;
+        default: break;
+        }
+        if (toupper(static_cast<unsigned char>(*end)) == 'B') end++;
+        if (*end != '\0') return false;
+        bytes = static_cast<int64_t>(value * scale);
+        return true;
+    }
+
+    // "90", "90s", "15m", "2h", "7d", "1w"
+    static bool parseDuration(const string& text, int64_t& seconds) {
+        char* end = NULL;
+        double value = strtod(text.c_str(), &end);
+        if (end == text.c_str() || value < 0) return false;
+        double scale = 1;
+        switch (*end) {
+        case 's': end++; break;
+        case 'm': scale = 60; end++; break;
+        case 'h': scale = 3600; end++; break;
+        case 'd': scale = 86400; end++; break;
+        case 'w': scale = 7 * 86400; end++; break;
+        default: break;
+        }
+        if (*end != '\0') return false;
+        seconds = static_cast<int64_t>(value * scale);
+        return true;
+    }
+
+    // Parses whitespace-separated terms:
+    //   sort=name|size|mtime|ext|natural  reverse  dirsfirst  mixed
+    //   limit=N (or top=N)  type=f|d|l  size>N  size<N  minsize=N  maxsize=N
+    //   newer=DURATION  older=DURATION  name=GLOB
+    // Sorting by size or mtime lists directories among the files unless
+    // "dirsfirst" is given. Returns false and sets 'error' on a bad term.
+    static bool parse(const string& spec, ListingQuery& query, string& error) {
+        query = ListingQuery();
+        istringstream terms(spec);
+        string term;
+        bool groupingSet = false;
+        while (terms >> term) {
+            size_t eq = term.find('=');
+            string key = eq == string::npos ? term : term.substr(0, eq);
+            string value = eq == string::npos ? "" : term.substr(eq + 1);
+            bool ok = true;
+
+            if (term == "reverse" || term == "-r") {
+                query.reverse = true;
+            } else if (term == "dirsfirst" || term == "mixed") {
+                query.directoriesFirst = term == "dirsfirst";
+                groupingSet = true;
+            } else if (key == "sort") {
+                if (value == "name") query.sortKey = SORT_NAME;
+                else if (value == "size") query.sortKey = SORT_SIZE;
+                else if (value == "mtime" || value == "time") query.sortKey = SORT_MTIME;
+                else if (value == "ext" || value == "extension") query.sortKey = SORT_EXTENSION;
+                else if (value == "natural" || value == "version") query.sortKey = SORT_NATURAL;
+                else ok = false;
+            } else if (key == "limit" || key == "top") {
+                char* end = NULL;
+                unsigned long long n = strtoull(value.c_str(), &end, 10);
+                ok = !value.empty() && *end == '\0' && n > 0;
+                query.limit = static_cast<size_t>(n);
+            } else if (key == "type") {
+                if (value == "f" || value == "file") query.type = TYPE_FILE;
+                else if (value == "d" || value == "dir") query.type = TYPE_DIRECTORY;
+                else if (value == "l" || value == "link") query.type = TYPE_LINK;
+                else ok = false;
+            } else if (term.compare(0, 5, "size>") == 0) {
+                ok = parseSize(term.substr(5), query.minSize);
+                query.minSize++;
+            } else if (term.compare(0, 5, "size<") == 0) {
+                ok = parseSize(term.substr(5), query.maxSize) && query.maxSize > 0;
+                query.maxSize--;
+            } else if (key == "minsize") {
+                ok = parseSize(value, query.minSize);
+            } else if (key == "maxsize") {
+                ok = parseSize(value, query.maxSize);
+            } else if (key == "newer") {
+                ok = parseDuration(value, query.newerThan);
+            } else if (key == "older") {
+                ok = parseDuration(value, query.olderThan);
+            } else if (key == "name") {
+                ok = !value.empty();
+                query.glob = value;
+            } else {
+                ok = false;
+            }
+
+            if (!ok) {
+                error = "invalid listing term '" + term + "'";
+                return false;
+            }
+        }
+        if (!groupingSet) {
+            query.directoriesFirst = query.sortKey != SORT_SIZE && query.sortKey != SORT_MTIME;
+        }
+        return true;
+    }
+};
+
+// Persistent, memory-mapped index of every name below a root directory, in
+// the style of locate(1). Paths are stored relative to the root and
+// front-coded against the previous path; every RESTART_INTERVAL records a
+// full path starts a new block, so blocks decode independently and a query
+// can scan them in parallel.
+//
+// Changes made after the index was built are kept in an in-memory overlay
+// (added entries, and removed entries or subtrees) that queries merge with
+// the mapped records. compact() folds the overlay back into the file.
+//
+// File layout: Header, root path, records, block offset table (uint64_t).
+// Record: varint shared-prefix length, varint suffix length, type byte,
+// suffix bytes.
+class NameIndex {
+public:
+    static const uint32_t RESTART_INTERVAL = 1024;
+
+    struct Header {
+        char magic[8];
+        uint64_t entryCount;
+        uint64_t blockCount;
+        uint64_t blockTableOffset;
+        int64_t buildTime;
+        uint32_t rootLength;
+        uint32_t reserved;
+    };
+
+    enum EntryType { ENTRY_FILE = 0, ENTRY_DIRECTORY = 1 };
+
+private:
+    static const char* magicBytes() {
+        return "FEIDX01";  // 7 characters plus the terminator fill magic[8]
+    }
+
+    string root;
+    string filePath;
+    const char* data;
+    size_t dataSize;
+    Header header;
+    struct timespec fileMtime;
+
+    // Overlay of changes since the file was written, guarded by overlayMutex
+    mutable mutex overlayMutex;
+    map<string, unsigned char> added;   // path -> EntryType
+    set<string> replaced;               // mapped records superseded by 'added'
+    set<string> removedTrees;           // mapped records hidden with their subtree
+
+    // Helper class that writes records through a large buffer
+    class Writer {
+    private:
+        int fd;
+        vector<char> buffer;
+        uint64_t offset;
+        string previous;
+        bool ok;
+
+        void putVarint(uint64_t value) {
+            while (value >= 0x80) {
+                buffer.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            buffer.push_back(static_cast<char>(value));
+        }
+
+    public:
+        uint64_t count;
+        vector<uint64_t> blockOffsets;
+
+        Writer(int fileFd, uint64_t startOffset) : fd(fileFd), offset(startOffset), ok(true), count(0) {
+            buffer.reserve(1 << 20);
+        }
+
+        void flush() {
+            size_t done = 0;
+            while (ok && done < buffer.size()) {
+                ssize_t n = write(fd, buffer.data() + done, buffer.size() - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) ok = false;
+                else done += n;
+            }
+            offset += buffer.size();
+            buffer.clear();
+        }
+
+        void add(const string& path, unsigned char type) {
+            size_t shared = 0;
+            if (count % RESTART_INTERVAL == 0) {
+                flush();
+                blockOffsets.push_back(offset);
+            } else {
+                size_t limit = min(previous.size(), path.size());
+                while (shared < limit && previous[shared] == path[shared]) shared++;
+            }
+            putVarint(shared);
+            putVarint(path.size() - shared);
+            buffer.push_back(static_cast<char>(type));
+            buffer.insert(buffer.end(), path.begin() + shared, path.end());
+            previous = path;
+            count++;
+            if (buffer.size() >= (1 << 20)) flush();
+        }
+
+        void putRaw(const void* bytes, size_t length) {
+            const char* p = static_cast<const char*>(bytes);
+            buffer.insert(buffer.end(), p, p + length);
+        }
+
+        uint64_t position() const {
+            return offset + buffer.size();
+        }
+
+        bool good() const {
+            return ok;
+        }
+    };
+
+    static bool getVarint(const char*& pos, const char* end, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; pos < end && shift < 64; shift += 7) {
+            unsigned char byte = static_cast<unsigned char>(*pos++);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    // Decode block 'block', calling visit(path, type) for every record
+    template <typename Visitor>
+    bool decodeBlock(uint64_t block, Visitor visit) const {
+        const uint64_t* table = reinterpret_cast<const uint64_t*>(data + header.blockTableOffset);
+        const char* pos = data + table[block];
+        const char* end = data + (block + 1 < header.blockCount ? table[block + 1] : header.blockTableOffset);
+        string path;
+        path.reserve(PATH_MAX);
+        while (pos < end) {
+            uint64_t shared, length;
+            if (!getVarint(pos, end, shared) || !getVarint(pos, end, length)) return false;
+            if (shared > path.size() || pos + 1 + length > end) return false;
+            unsigned char type = static_cast<unsigned char>(*pos++);
+            path.resize(shared);
+            path.append(pos, length);
+            pos += length;
+            visit(path, type);
+        }
+        return true;
+    }
+
+    // Helper function to tell whether a mapped record is hidden by the
+    // overlay. Records arrive grouped by directory, so the answer for the
+    // parent directory is memoised in memoParent/memoHidden.
+    bool isHidden(const string& path, string& memoParent, bool& memoHidden) const {
+        if (replaced.count(path) || removedTrees.count(path)) return true;
+        if (removedTrees.empty()) return false;
+        size_t slash = path.find_last_of('/');
+        if (slash == string::npos) return false;
+        if (memoParent.size() == slash && path.compare(0, slash, memoParent) == 0) return memoHidden;
+
+        memoParent.assign(path, 0, slash);
+        memoHidden = false;
+        string ancestor = memoParent;
+        for (;;) {
+            if (removedTrees.count(ancestor)) {
+                memoHidden = true;
+                break;
+            }
+            size_t up = ancestor.find_last_of('/');
+            if (up == string::npos) break;
+            ancestor.resize(up);
+        }
+        return memoHidden;
+    }
+
+    // Helper function to test whether 'path' is 'prefix' itself or below it
+    static bool isWithin(const string& path, const string& prefix) {
+        return path.compare(0, prefix.size(), prefix) == 0
+            && (path.size() == prefix.size() || path[prefix.size()] == '/');
+    }
+
+    // Drop overlay entries for 'path' and everything below it
+    void eraseAddedTree(const string& path) {
+        auto it = added.lower_bound(path);
+        while (it != added.end() && it->first.compare(0, path.size(), path) == 0) {
+            if (isWithin(it->first, path)) {
+                replaced.erase(it->first);
+                it = added.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void unmap() {
+        if (data != NULL) munmap(const_cast<char*>(data), dataSize);
+        data = NULL;
+        dataSize = 0;
+    }
+
+    // Write an index file for 'rootPath' whose records come from
+    // produce(writer), replacing any existing one atomically
+    static bool writeIndex(const string& rootPath, const function<void(Writer&)>& produce,
+                           uint64_t& entryCount, string& error) {
+        string dir = indexDirectory();
+        for (size_t slash = 1; slash != string::npos; slash = dir.find('/', slash + 1)) {
+            mkdir(dir.substr(0, slash).c_str(), 0755);
+        }
+        mkdir(dir.c_str(), 0755);
+
+        string target = indexPathFor(rootPath);
+        string temp = target + ".tmp." + to_string(getpid());
+        int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            error = "cannot create " + temp + ": " + strerror(errno);
+            return false;
+        }
+
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, magicBytes(), sizeof(header.magic));
+        header.buildTime = time(NULL);
+        header.rootLength = static_cast<uint32_t>(rootPath.size());
+
+        Writer writer(fd, 0);
+        writer.putRaw(&header, sizeof(header));
+        writer.putRaw(rootPath.data(), rootPath.size());
+        produce(writer);
+
+        // Pad so the offset table is 8-byte aligned in the mapping
+        static const char padding[sizeof(uint64_t)] = {0};
+        writer.putRaw(padding, (sizeof(uint64_t) - writer.position() % sizeof(uint64_t)) % sizeof(uint64_t));
+        writer.flush();
+        header.entryCount = writer.count;
+        header.blockCount = writer.blockOffsets.size();
+        header.blockTableOffset = writer.position();
+        writer.putRaw(writer.blockOffsets.data(), writer.blockOffsets.size() * sizeof(uint64_t));
+        writer.flush();
+
+        bool ok = writer.good() && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+        ok = (fsync(fd) == 0) && ok;
+        ok = (close(fd) == 0) && ok;
+        if (!ok || rename(temp.c_str(), target.c_str()) != 0) {
+            error = string("cannot write index: ") + strerror(errno);
+            unlink(temp.c_str());
+            return false;
+        }
+        entryCount = header.entryCount;
+        return true;
+    }
+
+    // load() for callers already holding overlayMutex
+    bool loadLocked(const string& rootPath) {
+        added.clear();
+        replaced.clear();
+        removedTrees.clear();
+        unmap();
+        root = rootPath;
+        filePath = indexPathFor(rootPath);
+        int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+
+        struct stat fileStat;
+        bool ok = countedStat(fd, "", &fileStat, AT_EMPTY_PATH) == 0
+                  && static_cast<size_t>(fileStat.st_size) >= sizeof(Header);
+        if (ok) {
+            void* mapped = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = static_cast<const char*>(mapped);
+                dataSize = fileStat.st_size;
+                fileMtime = fileStat.st_mtim;
+            }
+        }
+        close(fd);
+        if (data == NULL) return false;
+
+        memcpy(&header, data, sizeof(header));
+        bool valid = memcmp(header.magic, magicBytes(), sizeof(header.magic)) == 0
+            && sizeof(Header) + header.rootLength <= dataSize
+            && string(data + sizeof(Header), header.rootLength) == rootPath
+            && header.blockTableOffset <= dataSize
+            && header.blockCount * sizeof(uint64_t) <= dataSize - header.blockTableOffset
+            && header.blockTableOffset % sizeof(uint64_t) == 0;
+        if (valid) {
+            const uint64_t* table = reinterpret_cast<const uint64_t*>(data + header.blockTableOffset);
+            for (uint64_t i = 0; i < header.blockCount && valid; i++) {
+                valid = table[i] >= sizeof(Header) + header.rootLength && table[i] <= header.blockTableOffset
+                    && (i == 0 || table[i] >= table[i - 1]);
+            }
+        }
+        if (!valid) unmap();
+        return valid;
+    }
+
+public:
+    NameIndex() : data(NULL), dataSize(0) {
+        memset(&header, 0, sizeof(header));
+        memset(&fileMtime, 0, sizeof(fileMtime));
+    }
+
+    ~NameIndex() {
+        unmap();
+    }
+
+    // Directory holding the index files ($XDG_CACHE_HOME/file_explorer)
+    static string indexDirectory() {
+        const char* cache = getenv("XDG_CACHE_HOME");
+        if (cache != NULL && cache[0] == '/') return string(cache) + "/file_explorer";
+        const char* home = getenv("HOME");
+        return string(home ? home : "/tmp") + "/.cache/file_explorer";
+    }
+
+    // Index file for a canonical root path
+    static string indexPathFor(const string& rootPath) {
+        uint64_t hash = 1469598103934665603ULL;  // FNV-1a
+        for (unsigned char c : rootPath) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+        char name[40];
+        snprintf(name, sizeof(name), "/index-%016llx.idx", static_cast<unsigned long long>(hash));
+        return indexDirectory() + name;
+    }
+
+    // Depth-first walk below rootPath/start (children in name order),
+    // calling visit(relativePath, isDirectory). Symlinks are reported but
+    // not followed.
+    static void walkTree(const string& rootPath, const string& start,
+                         const function<void(const string&, bool)>& visit) {
+        vector<string> pending(1, start);
+        vector<pair<string, bool>> children;
+        while (!pending.empty()) {
+            string relative = move(pending.back());
+            pending.pop_back();
+            string full = relative.empty() ? rootPath : rootPath + "/" + relative;
+            int dirFd = open(full.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (dirFd < 0) continue;
+
+            children.clear();
+            DirReader reader(dirFd);
+            const char* name;
+            unsigned char type;
+            while (reader.next(name, type)) {
+                if (isDotOrDotDot(name)) continue;
+                if (type == DT_UNKNOWN) {
+                    struct stat entryStat;
+                    if (countedStat(dirFd, name, &entryStat, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                    type = S_ISDIR(entryStat.st_mode) ? DT_DIR : DT_REG;
+                }
+                children.push_back(make_pair(string(name), type == DT_DIR));
+            }
+            close(dirFd);
+            sort(children.begin(), children.end());
+
+            size_t firstSubdir = pending.size();
+            for (const auto& child : children) {
+                string path = relative.empty() ? child.first : relative + "/" + child.first;
+                visit(path, child.second);
+                if (child.second) pending.push_back(path);
+            }
+            // Visit subdirectories in name order
+            reverse(pending.begin() + firstSubdir, pending.end());
+        }
+    }
+
+    // Walk 'rootPath' (canonical) and write its index file
+    static bool build(const string& rootPath, uint64_t& entryCount, string& error) {
+        return writeIndex(rootPath, [&rootPath](Writer& writer) {
+            walkTree(rootPath, "", [&writer](const string& path, bool isDir) {
+                writer.add(path, isDir ? ENTRY_DIRECTORY : ENTRY_FILE);
+            });
+        }, entryCount, error);
+    }
+
+    // Map the index of 'rootPath', if one exists and is well-formed. Any
+    // overlay is discarded.
+    bool load(const string& rootPath) {
+        lock_guard<mutex> lock(overlayMutex);
+        return loadLocked(rootPath);
+    }
+
+    bool isLoaded() const {
+        lock_guard<mutex> lock(overlayMutex);
+        return data != NULL;
+    }
+
+    // True while the file on disk is still the one that was mapped
+    bool isCurrent() const {
+        struct stat fileStat;
+        lock_guard<mutex> lock(overlayMutex);
+        return data != NULL && countedStat(AT_FDCWD, filePath.c_str(), &fileStat, 0) == 0
+            && fileStat.st_mtim.tv_sec == fileMtime.tv_sec && fileStat.st_mtim.tv_nsec == fileMtime.tv_nsec;
+    }
+
+    // A copy: the watcher thread may reload or compact the index meanwhile
+    string getRoot() const {
+        lock_guard<mutex> lock(overlayMutex);
+        return root;
+    }
+
+    uint64_t entryCount() const {
+        lock_guard<mutex> lock(overlayMutex);
+        return header.entryCount;
+    }
+
+    time_t buildTime() const {
+        lock_guard<mutex> lock(overlayMutex);
+        return static_cast<time_t>(header.buildTime);
+    }
+
+    // Number of pending overlay changes
+    size_t overlaySize() const {
+        lock_guard<mutex> lock(overlayMutex);
+        return added.size() + removedTrees.size();
+    }
+
+    // Record a new entry (root-relative path)
+    void noteCreated(const string& path, bool isDir) {
+        lock_guard<mutex> lock(overlayMutex);
+        added[path] = isDir ? ENTRY_DIRECTORY : ENTRY_FILE;
+        replaced.insert(path);
+    }
+
+    // Record a new directory together with whatever is already inside it
+    // (e.g. one that was moved or copied in); returns the directories seen
+    void noteCreatedTree(const string& path, vector<string>* directories = NULL) {
+        noteCreated(path, true);
+        if (directories) directories->push_back(path);
+        // The overflow reload swaps 'root' under the lock; walk a copy
+        string rootPath = getRoot();
+        walkTree(rootPath, path, [this, directories](const string& child, bool isDir) {
+            noteCreated(child, isDir);
+            if (isDir && directories) directories->push_back(child);
+        });
+    }
+
+    // Record the removal of an entry and everything below it
+    void noteRemoved(const string& path) {
+        lock_guard<mutex> lock(overlayMutex);
+        eraseAddedTree(path);
+        removedTrees.insert(path);
+    }
+
+    // Call visit(relativePath) for every indexed directory, overlay included
+    void forEachDirectory(const function<void(const string&)>& visit) const {
+        lock_guard<mutex> lock(overlayMutex);
+        string memoParent;
+        bool memoHidden = false;
+        for (uint64_t block = 0; data != NULL && block < header.blockCount; block++) {
+            decodeBlock(block, [&](const string& path, unsigned char type) {
+                if (type == ENTRY_DIRECTORY && !isHidden(path, memoParent, memoHidden)) visit(path);
+            });
+        }
+        for (const auto& entry : added) {
+            if (entry.second == ENTRY_DIRECTORY) visit(entry.first);
+        }
+    }
+
+    // Rewrite the index file with the overlay merged in, without crawling
+    bool compact(string& error) {
+        uint64_t entryCount = 0;
+        lock_guard<mutex> lock(overlayMutex);
+        bool ok = writeIndex(root, [this](Writer& writer) {
+            string memoParent;
+            bool memoHidden = false;
+            for (uint64_t block = 0; data != NULL && block < header.blockCount; block++) {
+                decodeBlock(block, [&](const string& path, unsigned char type) {
+                    if (!isHidden(path, memoParent, memoHidden)) writer.add(path, type);
+                });
+            }
+            for (const auto& entry : added) {
+                writer.add(entry.first, entry.second);
+            }
+        }, entryCount, error);
+        return ok && loadLocked(root);
+    }
+
+    // Names below 'subPath' (relative to the root, "" for the root itself)
+    // accepted by 'matcher'. Results are root-relative paths: mapped records
+    // in index order, then overlay additions.
+    void query(const string& subPath, const NameMatcher& matcher, WorkerPool* pool, vector<string>& results) const {
+        lock_guard<mutex> lock(overlayMutex);
+        if (data == NULL) return;
+        string prefix = subPath.empty() ? string() : subPath + "/";
+        bool hasOverlay = !replaced.empty() || !removedTrees.empty();
+
+        auto matches = [&](const string& path) {
+            if (path.size() <= prefix.size() || path.compare(0, prefix.size(), prefix) != 0) return false;
+            size_t nameStart = path.find_last_of('/');
+            nameStart = (nameStart == string::npos) ? 0 : nameStart + 1;
+            return matcher.matches(path.data() + nameStart, path.size() - nameStart);
+        };
+
+        vector<vector<string>> perBlock(header.blockCount);
+        auto scanBlock = [&](size_t block) {
+            vector<string>& out = perBlock[block];
+            string memoParent;
+            bool memoHidden = false;
+            decodeBlock(block, [&](const string& path, unsigned char) {
+                if (!matches(path)) return;
+                if (hasOverlay && isHidden(path, memoParent, memoHidden)) return;
+                out.push_back(path);
+            });
+        };
+        if (pool != NULL && pool->size() > 1 && header.blockCount > 1) {
+            pool->parallelFor(header.blockCount, scanBlock, 1);
+        } else {
+            for (size_t block = 0; block < header.blockCount; block++) scanBlock(block);
+        }
+
+        for (auto& block : perBlock) {
+            for (auto& path : block) results.push_back(move(path));
+        }
+        for (const auto& entry : added) {
+            if (matches(entry.first)) results.push_back(entry.first);
+        }
+    }
+};
+
+// Background thread that keeps a NameIndex up to date from inotify events
+// on every directory below its root. Created, deleted and moved entries are
+// applied to the index overlay as they arrive; the overlay is compacted
+// into the index file once it grows past COMPACT_THRESHOLD. If the kernel
+// event queue overflows, the index is rebuilt from scratch. (fanotify would
+// avoid one watch per directory but needs CAP_SYS_ADMIN, so it is not used.)
+class IndexWatcher {
+public:
+    static const size_t COMPACT_THRESHOLD = 16384;
+    // How often the thread looks at 'stopping' if the wake-up write failed
+    static const int STOP_CHECK_MS = 1000;
+
+private:
+    static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                                     | IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+    NameIndex& index;
+    string root;
+    int inotifyFd;
+    int wakeFd;
+    thread worker;
+    unordered_map<int, string> watches;  // watch descriptor -> relative dir
+    atomic<size_t> watchCount;
+    atomic<bool> watchLimitReached;
+    atomic<bool> stopping;  // backs up the eventfd wake-up
+
+    void addWatch(const string& relative) {
+        if (watchLimitReached) return;
+        string full = relative.empty() ? root : root + "/" + relative;
+        int wd = inotify_add_watch(inotifyFd, full.c_str(), WATCH_MASK);
+        if (wd >= 0) {
+            watches[wd] = relative;
+            watchCount = watches.size();
+        } else if (errno == ENOSPC) {
+            // fs.inotify.max_user_watches exhausted; changes below the
+            // unwatched directories are picked up by the next rebuild
+            watchLimitReached = true;
+        }
+    }
+
+    void addAllWatches() {
+        addWatch("");
+        index.forEachDirectory([this](const string& relative) {
+            addWatch(relative);
+        });
+    }
+
+    void dropWatchesBelow(const string& relative) {
+        for (auto it = watches.begin(); it != watches.end();) {
+            const string& path = it->second;
+            if (path.compare(0, relative.size(), relative) == 0
+                && (path.size() == relative.size() || path[relative.size()] == '/')) {
+                inotify_rm_watch(inotifyFd, it->first);
+                it = watches.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        watchCount = watches.size();
+    }
+
+    void handleEvent(const struct inotify_event* event) {
+        if (event->mask & IN_Q_OVERFLOW) {
+            // Events were lost: start over from a fresh crawl
+            for (const auto& watch : watches) {
+                inotify_rm_watch(inotifyFd, watch.first);
+            }
+            watches.clear();
+            uint64_t entryCount;
+            string error;
+            if (NameIndex::build(root, entryCount, error)) {
+                index.load(root);
+            }
+            watchLimitReached = false;
+            addAllWatches();
+            return;
+        }
+
+        auto dir = watches.find(event->wd);
+        if (dir == watches.end()) return;
+        if (event->mask & IN_IGNORED) {
+            watches.erase(dir);
+            watchCount = watches.size();
+            return;
+        }
+        if (event->len == 0) return;
+
+        string path = dir->second.empty() ? string(event->name) : dir->second + "/" + event->name;
+        bool isDir = (event->mask & IN_ISDIR) != 0;
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            if (isDir) {
+                // Also catches whatever landed inside before the watch did
+                vector<string> directories;
+                index.noteCreatedTree(path, &directories);
+                for (const auto& directory : directories) {
+                    addWatch(directory);
+                }
+            } else {
+                index.noteCreated(path, false);
+            }
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            index.noteRemoved(path);
+            if (isDir) dropWatchesBelow(path);
+        }
+    }
+
+    void run() {
+        addAllWatches();
+
+        alignas(struct inotify_event) char buffer[64 * 1024];
+        struct pollfd fds[2];
+        fds[0].fd = inotifyFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = wakeFd;
+        fds[1].events = POLLIN;
+        while (!stopping) {
+            int ready = poll(fds, 2, STOP_CHECK_MS);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            if (ready == 0) continue;
+            if (fds[1].revents & POLLIN) return;
+
+            ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+            if (length <= 0) continue;
+            for (char* pos = buffer; pos < buffer + length;) {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(pos);
+                handleEvent(event);
+                pos += sizeof(struct inotify_event) + event->len;
+            }
+
+            if (index.overlaySize() >= COMPACT_THRESHOLD) {
+                string error;
+                index.compact(error);
+            }
+        }
+    }
+
+public:
+    explicit IndexWatcher(NameIndex& watchedIndex)
+        : index(watchedIndex), root(watchedIndex.getRoot()), inotifyFd(-1), wakeFd(-1),
+          watchCount(0), watchLimitReached(false), stopping(false) {}
+
+    ~IndexWatcher() {
+        stop();
+    }
+
+    bool start() {
+        stopping = false;
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+        if (inotifyFd < 0 || wakeFd < 0) {
+            stop();
+            return false;
+        }
+        worker = thread(&IndexWatcher::run, this);
+        return true;
+    }
+
+    // Always joins the thread before the fds it polls are closed; if the
+    // wake-up cannot be written, the thread still sees 'stopping' within
+    // STOP_CHECK_MS
+    void stop() {
+        if (worker.joinable()) {
+            stopping = true;
+            uint64_t one = 1;
+            for (int attempt = 0; attempt < 3; attempt++) {
+                if (write(wakeFd, &one, sizeof(one)) == sizeof(one)) break;
+                if (errno != EINTR && errno != EAGAIN) break;
+            }
+            worker.join();
+        }
+        if (inotifyFd >= 0) close(inotifyFd);
+        if (wakeFd >= 0) close(wakeFd);
+        inotifyFd = -1;
+        wakeFd = -1;
+    }
+
+    size_t watchedDirectories() const {
+        return watchCount.load();
+    }
+
+    bool isWatchLimitReached() const {
+        return watchLimitReached.load();
+    }
+};
+
+// What searchFiles matches the search term against
+enum SearchMode {
+    SEARCH_NAMES,           // file and directory names
+    SEARCH_CONTENTS,        // file contents, literal text
+    SEARCH_CONTENTS_REGEX   // file contents, ECMAScript regular expression
+};
+
+// One matching line of a content search
+struct ContentMatch {
+    size_t line;
+    string text;
+};
+
+// Helper class for content search (grep mode). The calling thread walks
+// the tree and queues every regular file on a WorkerPool; workers read the
+// file (pread for small files, mmap for large ones), skip it if the first
+// bytes look binary, and collect matching lines. Finished files are handed
+// back to the caller strictly in walk order, as soon as each one's turn
+// comes, so output streams while the walk is still going.
+class ContentSearcher {
+public:
+    static const size_t SNIFF_BYTES = 8192;
+    static const size_t MMAP_THRESHOLD = 256 * 1024;
+    static const size_t DEFAULT_BYTE_BUDGET = 64 * 1024 * 1024;
+    static const size_t MAX_LINE_LENGTH = 200;
+    // std::regex recurses per character, so a long line (minified JS, one
+    // JSON document) would overflow a worker's stack; regexes only see
+    // this much of each line
+    static const size_t MAX_REGEX_LINE = 2048;
+    // Files in flight per worker before the walker waits for output
+    static const size_t WINDOW_PER_THREAD = 64;
+
+    struct Stats {
+        size_t filesScanned;
+        size_t binarySkipped;
+        size_t truncated;
+        size_t unreadable;
+        size_t longLines;  // lines cut to MAX_REGEX_LINE for a regex
+        unsigned long long bytesRead;
+
+        Stats() : filesScanned(0), binarySkipped(0), truncated(0), unreadable(0), longLines(0), bytesRead(0) {}
+    };
+
+    typedef function<void(const string&, const vector<ContentMatch>&)> EmitFunction;
+
+private:
+    struct FileResult {
+        string path;
+        vector<ContentMatch> matches;
+        bool binary;
+        bool truncated;
+        bool unreadable;
+        size_t bytes;
+        size_t longLines;
+
+        FileResult() : binary(false), truncated(false), unreadable(false), bytes(0), longLines(0) {}
+    };
+
+    WorkerPool& pool;
+    NameMatcher literal;
+    unique_ptr<regex> expression;
+    size_t byteBudget;
+
+    mutex resultMutex;
+    condition_variable resultReady;
+    map<size_t, FileResult> finished;  // by walk order
+    size_t nextToEmit;
+    Stats stats;
+
+    static string clipLine(const char* begin, const char* end) {
+        if (end > begin && end[-1] == '\r') end--;
+        return string(begin, min(static_cast<size_t>(end - begin), static_cast<size_t>(MAX_LINE_LENGTH)));
+    }
+
+    void searchBuffer(const char* data, size_t length, FileResult& result) const {
+        vector<ContentMatch>& matches = result.matches;
+        const char* end = data + length;
+        size_t lineNumber = 1;
+        const char* counted = data;  // newlines before this point are counted
+
+        if (expression) {
+            for (const char* line = data; line < end;) {
+                const char* lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+                if (lineEnd == NULL) lineEnd = end;
+                const char* matchEnd = lineEnd;
+                if (static_cast<size_t>(lineEnd - line) > MAX_REGEX_LINE) {
+                    matchEnd = line + MAX_REGEX_LINE;
+                    result.longLines++;
+                }
+                if (regex_search(line, matchEnd, *expression)) {
+                    ContentMatch match;
+                    match.line = lineNumber;
+                    match.text = clipLine(line, lineEnd);
+                    matches.push_back(match);
+                }
+                lineNumber++;
+                line = lineEnd + 1;
+            }
+            return;
+        }
+
+        for (const char* pos = data; pos < end;) {
+            const char* hit = literal.find(pos, end - pos);
+            if (hit == NULL) break;
+            lineNumber += count(counted, hit, '\n');
+            const char* lineStart = hit;
+            while (lineStart > data && lineStart[-1] != '\n') lineStart--;
+            const char* lineEnd = static_cast<const char*>(memchr(hit, '\n', end - hit));
+            if (lineEnd == NULL) lineEnd = end;
+
+            ContentMatch match;
+            match.line = lineNumber;
+            match.text = clipLine(lineStart, lineEnd);
+            matches.push_back(match);
+
+            // One entry per line: continue after this line (its newline is
+            // counted with the next match)
+            counted = lineEnd;
+            pos = lineEnd < end ? lineEnd + 1 : end;
+        }
+    }
+
+    void searchFile(const string& path, FileResult& result) const {
+        result.path = path;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        struct stat fileStat;
+        if (fd < 0 || countedStat(fd, "", &fileStat, AT_EMPTY_PATH) != 0 || !S_ISREG(fileStat.st_mode)) {
+            result.unreadable = fd < 0;
+            if (fd >= 0) close(fd);
+            return;
+        }
+
+        size_t length = static_cast<size_t>(fileStat.st_size);
+        if (length > byteBudget) {
+            length = byteBudget;
+            result.truncated = true;
+        }
+        if (length == 0) {
+            close(fd);
+            return;
+        }
+
+        // Sniff: a NUL byte near the start means binary
+        char sniff[SNIFF_BYTES];
+        ssize_t sniffed = pread(fd, sniff, min(length, sizeof(sniff)), 0);
+        if (sniffed < 0 || memchr(sniff, '\0', sniffed) != NULL) {
+            result.binary = sniffed >= 0;
+            result.unreadable = sniffed < 0;
+            close(fd);
+            return;
+        }
+
+        if (static_cast<size_t>(sniffed) == length) {
+            result.bytes = length;
+            searchBuffer(sniff, length, result);
+        } else if (length <= MMAP_THRESHOLD) {
+            vector<char> buffer(length);
+            ssize_t got = pread(fd, buffer.data(), length, 0);
+            if (got > 0) {
+                result.bytes = got;
+                searchBuffer(buffer.data(), got, result);
+            }
+        } else {
+            void* mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                madvise(mapped, length, MADV_SEQUENTIAL);
+                result.bytes = length;
+                searchBuffer(static_cast<const char*>(mapped), length, result);
+                munmap(mapped, length);
+            } else {
+                result.unreadable = true;
+            }
+        }
+        close(fd);
+    }
+
+    // Emit finished results that are next in walk order. With 'block' set,
+    // waits (helping the pool) until at least one result was emitted.
+    void drain(const EmitFunction& emit, size_t submitted, bool block) {
+        for (;;) {
+            FileResult result;
+            {
+                unique_lock<mutex> lock(resultMutex);
+                auto it = finished.find(nextToEmit);
+                if (it == finished.end()) {
+                    if (!block || nextToEmit >= submitted) return;
+                    lock.unlock();
+                    if (!pool.helpOne()) {
+                        lock.lock();
+                        resultReady.wait_for(lock, chrono::milliseconds(5));
+                    }
+                    continue;
+                }
+                result = move(it->second);
+                finished.erase(it);
+                nextToEmit++;
+            }
+            block = false;
+
+            stats.filesScanned++;
+            stats.bytesRead += result.bytes;
+            if (result.binary) stats.binarySkipped++;
+            if (result.truncated && !result.binary) stats.truncated++;
+            if (result.unreadable) stats.unreadable++;
+            stats.longLines += result.longLines;
+            if (!result.matches.empty()) emit(result.path, result.matches);
+        }
+    }
+
+public:
+    ContentSearcher(WorkerPool& workerPool, const string& pattern, bool isRegex,
+                    size_t maxBytesPerFile = DEFAULT_BYTE_BUDGET)
+        : pool(workerPool), literal(pattern, NameMatcher::MATCH_SUBSTRING),
+          byteBudget(maxBytesPerFile), nextToEmit(0) {
+        if (isRegex) {
+            // Throws regex_error for an invalid pattern
+            expression.reset(new regex(pattern, regex::ECMAScript | regex::icase | regex::optimize));
+        }
+    }
+
+    // Search every regular file below basePath (symlinks are not followed)
+    // and call emit(path, matches) for each file with matches, in walk order
+    Stats run(const string& basePath, const EmitFunction& emit) {
+        WorkerPool::TaskGroup group;
+        size_t submitted = 0;
+        size_t window = WINDOW_PER_THREAD * max(1u, pool.size());
+
+        vector<string> pending(1, basePath);
+        while (!pending.empty()) {
+            string dirPath = move(pending.back());
+            pending.pop_back();
+            int dirFd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (dirFd < 0) continue;
+
+            vector<pair<string, unsigned char>> children;
+            DirReader reader(dirFd);
+            const char* name;
+            unsigned char type;
+            while (reader.next(name, type)) {
+                if (isDotOrDotDot(name)) continue;
+                if (type == DT_UNKNOWN) {
+                    struct stat entryStat;
+                    if (countedStat(dirFd, name, &entryStat, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                    type = S_ISDIR(entryStat.st_mode) ? DT_DIR : (S_ISREG(entryStat.st_mode) ? DT_REG : DT_UNKNOWN);
+                }
+                if (type == DT_DIR || type == DT_REG) children.push_back(make_pair(string(name), type));
+            }
+            close(dirFd);
+            sort(children.begin(), children.end());
+
+            size_t firstSubdir = pending.size();
+            for (const auto& child : children) {
+                string fullPath = dirPath + "/" + child.first;
+                if (child.second == DT_DIR) {
+                    pending.push_back(fullPath);
+                    continue;
+                }
+
+                size_t sequence = submitted++;
+                pool.submit(group, [this, fullPath, sequence]() {
+                    FileResult result;
+                    searchFile(fullPath, result);
+                    lock_guard<mutex> lock(resultMutex);
+                    finished[sequence] = move(result);
+                    resultReady.notify_one();
+                });
+                drain(emit, submitted, submitted - nextToEmit >= window);
+            }
+            reverse(pending.begin() + firstSubdir, pending.end());
+        }
+
+        while (nextToEmit < submitted) {
+            drain(emit, submitted, true);
+        }
+        pool.wait(group);
+        return stats;
+    }
+};
+
+// Helper class computing XXH64, a fast non-cryptographic 64-bit hash,
+// incrementally over any number of update() calls
+class Hash64 {
+private:
+    static const uint64_t PRIME1 = 11400714785074694791ULL;
+    static const uint64_t PRIME2 = 14029467366897019727ULL;
+    static const uint64_t PRIME3 = 1609587929392839161ULL;
+    static const uint64_t PRIME4 = 9650029242287828579ULL;
+    static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+    uint64_t acc[4];
+    unsigned char pending[32];
+    size_t pendingLength;
+    uint64_t totalLength;
+    uint64_t seed;
+
+    static uint64_t rotl(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    static uint64_t read64(const unsigned char* p) {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static uint32_t read32(const unsigned char* p) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static uint64_t round(uint64_t accumulator, uint64_t input) {
+        accumulator += input * PRIME2;
+        return rotl(accumulator, 31) * PRIME1;
+    }
+
+    static uint64_t mergeRound(uint64_t accumulator, uint64_t value) {
+        accumulator ^= round(0, value);
+        return accumulator * PRIME1 + PRIME4;
+    }
+
+    void consumeStripe(const unsigned char* p) {
+        acc[0] = round(acc[0], read64(p));
+        acc[1] = round(acc[1], read64(p + 8));
+        acc[2] = round(acc[2], read64(p + 16));
+        acc[3] = round(acc[3], read64(p + 24));
+    }
+
+public:
+    explicit Hash64(uint64_t hashSeed = 0) : pendingLength(0), totalLength(0), seed(hashSeed) {
+        acc[0] = seed + PRIME1 + PRIME2;
+        acc[1] = seed + PRIME2;
+        acc[2] = seed;
+        acc[3] = seed - PRIME1;
+    }
+
+    void update(const void* data, size_t length) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        totalLength += length;
+        if (pendingLength + length < sizeof(pending)) {
+            memcpy(pending + pendingLength, p, length);
+            pendingLength += length;
+            return;
+        }
+        if (pendingLength > 0) {
+            size_t fill = sizeof(pending) - pendingLength;
+            memcpy(pending + pendingLength, p, fill);
+            consumeStripe(pending);
+            p += fill;
+            length -= fill;
+            pendingLength = 0;
+        }
+        for (; length >= sizeof(pending); p += sizeof(pending), length -= sizeof(pending)) {
+            consumeStripe(p);
+        }
+        memcpy(pending, p, length);
+        pendingLength = length;
+    }
+
+    uint64_t digest() const {
+        uint64_t h;
+        if (totalLength >= sizeof(pending)) {
+            h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+            for (int i = 0; i < 4; i++) h = mergeRound(h, acc[i]);
+        } else {
+            h = seed + PRIME5;
+        }
+        h += totalLength;
+
+        const unsigned char* p = pending;
+        const unsigned char* end = pending + pendingLength;
+        for (; p + 8 <= end; p += 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * PRIME1 + PRIME4;
+        }
+        if (p + 4 <= end) {
+            h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+            h = rotl(h, 23) * PRIME2 + PRIME3;
+            p += 4;
+        }
+        for (; p < end; p++) {
+            h ^= *p * PRIME5;
+            h = rotl(h, 11) * PRIME1;
+        }
+        h ^= h >> 33;
+        h *= PRIME2;
+        h ^= h >> 29;
+        h *= PRIME3;
+        h ^= h >> 32;
+        return h;
+    }
+};
+
+// Files below a root with identical contents
+struct DuplicateSet {
+    unsigned long long size;
+    vector<string> paths;  // sorted; the first one is kept when replacing
+
+    unsigned long long reclaimableBytes() const {
+        return size * (paths.size() - 1);
+    }
+};
+
+struct DuplicateReport {
+    vector<DuplicateSet> sets;        // most reclaimable bytes first
+    size_t filesScanned;
+    size_t sizeCandidates;            // files sharing their size with another
+    size_t edgeCandidates;            // ... and their first and last blocks
+    size_t hardLinksSkipped;          // extra names of an inode already seen
+    unsigned long long bytesHashed;
+    double seconds;
+    vector<pair<string, string>> errors;  // path, reason
+
+    DuplicateReport()
+        : filesScanned(0), sizeCandidates(0), edgeCandidates(0), hardLinksSkipped(0),
+          bytesHashed(0), seconds(0) {}
+
+    unsigned long long reclaimableBytes() const {
+        unsigned long long total = 0;
+        for (const auto& set : sets) total += set.reclaimableBytes();
+        return total;
+    }
+};
+
+// Helper class that finds duplicate files in stages, each of which only
+// looks at the survivors of the one before: files are grouped by size,
+// then by a hash of their first and last blocks, and only then hashed in
+// full. The hashing stages run on the worker pool with large preads. Hard
+// links to one inode count as one file.
+class DuplicateFinder {
+public:
+    static const size_t EDGE_BYTES = 4096;
+    static const size_t READ_BUFFER_SIZE = 1024 * 1024;
+
+    enum LinkMode { LINK_HARD, LINK_REFLINK };
+
+private:
+    struct Candidate {
+        string path;
+        off_t size;
+        uint64_t hash;
+        bool failed;
+    };
+
+    typedef vector<size_t> Group;  // indices into 'candidates'
+
+    WorkerPool* pool;
+    off_t minSize;
+    vector<Candidate> candidates;
+    mutex errorMutex;
+    DuplicateReport* report;
+
+    void recordError(const string& path, int error) {
+        lock_guard<mutex> lock(errorMutex);
+        report->errors.push_back(make_pair(path, strerror(error)));
+    }
+
+    // Collects regular files of at least minSize bytes, once per inode
+    void walk(const string& root) {
+        set<pair<dev_t, ino_t>> seen;
+        vector<string> pending(1, root);
+        while (!pending.empty()) {
+            string dirPath = move(pending.back());
+            pending.pop_back();
+            TreeDirectory dir(dirPath);
+            if (!dir.isOpen()) {
+                recordError(dirPath, dir.openError());
+                continue;
+            }
+
+            const char* name;
+            unsigned char type;
+            while (dir.next(name, type)) {
+                if (type == DT_DIR) {
+                    pending.push_back(dirPath + "/" + name);
+                    continue;
+                }
+                if (type != DT_REG && type != DT_UNKNOWN) continue;
+
+                const struct stat* entryStat = dir.entryStat();
+                if (entryStat == NULL) {
+                    recordError(dirPath + "/" + name, dir.statError());
+                    continue;
+                }
+                if (!S_ISREG(entryStat->st_mode) || entryStat->st_size < minSize) continue;
+                report->filesScanned++;
+                if (entryStat->st_nlink > 1 && !seen.insert(make_pair(entryStat->st_dev, entryStat->st_ino)).second) {
+                    report->hardLinksSkipped++;
+                    continue;
+                }
+
+                Candidate candidate;
+                candidate.path = dirPath + "/" + name;
+                candidate.size = entryStat->st_size;
+                candidate.hash = 0;
+                candidate.failed = false;
+                candidates.push_back(move(candidate));
+            }
+            if (dir.readError() != 0) recordError(dirPath, dir.readError());
+        }
+    }
+
+    // Hash of the first and last EDGE_BYTES; for files up to twice that
+    // size this covers the whole file
+    void hashEdges(Candidate& candidate) {
+        int fd = open(candidate.path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) {
+            recordError(candidate.path, errno);
+            candidate.failed = true;
+            return;
+        }
+        char buffer[2 * EDGE_BYTES];
+        size_t want = static_cast<size_t>(min<off_t>(candidate.size, 2 * EDGE_BYTES));
+        size_t head = min(want, static_cast<size_t>(EDGE_BYTES));
+        ssize_t got = pread(fd, buffer, head, 0);
+        if (got == static_cast<ssize_t>(head) && want > head) {
+            got = pread(fd, buffer + head, want - head, candidate.size - (want - head));
+            if (got >= 0 && got != static_cast<ssize_t>(want - head)) got = 0;
+        } else if (got >= 0 && got != static_cast<ssize_t>(head)) {
+            got = 0;
+        }
+        if (got < 0) recordError(candidate.path, errno);
+        close(fd);
+        // A short read means the file shrank since the walk, like a size
+        // mismatch in hashContents: it is dropped rather than compared
+        if (got <= 0 && want > 0) {
+            candidate.failed = true;
+            return;
+        }
+
+        Hash64 hash;
+        hash.update(buffer, want);
+        candidate.hash = hash.digest();
+    }
+
+    unsigned long long hashContents(Candidate& candidate) {
+        int fd = open(candidate.path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) {
+            recordError(candidate.path, errno);
+            candidate.failed = true;
+            return 0;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        vector<char> buffer(READ_BUFFER_SIZE);
+        Hash64 hash;
+        unsigned long long done = 0;
+        for (;;) {
+            ssize_t got = read(fd, buffer.data(), buffer.size());
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) {
+                recordError(candidate.path, errno);
+                candidate.failed = true;
+                break;
+            }
+            if (got == 0) break;
+            hash.update(buffer.data(), got);
+            done += got;
+        }
+        close(fd);
+        // A file that changed size since the walk cannot be compared
+        if (!candidate.failed && done != static_cast<unsigned long long>(candidate.size)) {
+            candidate.failed = true;
+        }
+        candidate.hash = hash.digest();
+        return done;
+    }
+
+    // Splits every group by candidate hash; drops failures and singletons
+    vector<Group> splitByHash(const vector<Group>& groups) {
+        vector<Group> result;
+        for (const Group& group : groups) {
+            Group members;
+            for (size_t index : group) {
+                if (!candidates[index].failed) members.push_back(index);
+            }
+            sort(members.begin(), members.end(), [this](size_t a, size_t b) {
+                return candidates[a].hash < candidates[b].hash;
+            });
+            for (size_t begin = 0; begin < members.size();) {
+                size_t end = begin + 1;
+                while (end < members.size() && candidates[members[end]].hash == candidates[members[begin]].hash) end++;
+                if (end - begin > 1) result.push_back(Group(members.begin() + begin, members.begin() + end));
+                begin = end;
+            }
+        }
+        return result;
+    }
+
+    // Runs 'fn' on every candidate in 'groups', on the pool when there is one
+    void forEachCandidate(const vector<Group>& groups, const function<void(Candidate&)>& fn, size_t chunk) {
+        vector<size_t> work;
+        for (const Group& group : groups) work.insert(work.end(), group.begin(), group.end());
+        auto one = [&](size_t i) { fn(candidates[work[i]]); };
+        if (pool != NULL && pool->size() > 1) {
+            pool->parallelFor(work.size(), one, chunk);
+        } else {
+            for (size_t i = 0; i < work.size(); i++) one(i);
+        }
+    }
+
+public:
+    explicit DuplicateFinder(WorkerPool* workerPool, off_t minimumSize = 1)
+        : pool(workerPool), minSize(max<off_t>(minimumSize, 1)), report(NULL) {}
+
+    DuplicateReport find(const string& root) {
+        DuplicateReport result;
+        report = &result;
+        candidates.clear();
+        auto start = chrono::steady_clock::now();
+
+        walk(root);
+
+        // Stage 1: equal sizes
+        vector<size_t> bySize(candidates.size());
+        for (size_t i = 0; i < bySize.size(); i++) bySize[i] = i;
+        sort(bySize.begin(), bySize.end(), [this](size_t a, size_t b) {
+            return candidates[a].size < candidates[b].size;
+        });
+        vector<Group> groups;
+        for (size_t begin = 0; begin < bySize.size();) {
+            size_t end = begin + 1;
+            while (end < bySize.size() && candidates[bySize[end]].size == candidates[bySize[begin]].size) end++;
+            if (end - begin > 1) {
+                groups.push_back(Group(bySize.begin() + begin, bySize.begin() + end));
+                result.sizeCandidates += end - begin;
+            }
+            begin = end;
+        }
+
+        // Stage 2: first and last blocks
+        atomic<unsigned long long> hashed(0);
+        forEachCandidate(groups, [&](Candidate& candidate) {
+            hashEdges(candidate);
+            hashed += static_cast<unsigned long long>(min<off_t>(candidate.size, 2 * EDGE_BYTES));
+        }, 16);
+        groups = splitByHash(groups);
+
+        // Stage 3: full contents, except for files the edges already covered
+        vector<Group> complete, partial;
+        for (Group& group : groups) {
+            result.edgeCandidates += group.size();
+            if (candidates[group[0]].size <= static_cast<off_t>(2 * EDGE_BYTES)) complete.push_back(move(group));
+            else partial.push_back(move(group));
+        }
+        forEachCandidate(partial, [&](Candidate& candidate) { hashed += hashContents(candidate); }, 1);
+        partial = splitByHash(partial);
+        complete.insert(complete.end(), make_move_iterator(partial.begin()), make_move_iterator(partial.end()));
+
+        for (const Group& group : complete) {
+            DuplicateSet set;
+            set.size = candidates[group[0]].size;
+            for (size_t index : group) set.paths.push_back(candidates[index].path);
+            sort(set.paths.begin(), set.paths.end());
+            result.sets.push_back(move(set));
+        }
+        sort(result.sets.begin(), result.sets.end(), [](const DuplicateSet& a, const DuplicateSet& b) {
+            return a.reclaimableBytes() > b.reclaimableBytes();
+        });
+
+        result.bytesHashed = hashed;
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        candidates.clear();
+        report = NULL;
+        return result;
+    }
+
+    // Byte-for-byte comparison, so a hash collision can never cause a
+    // file to be replaced by a different one
+    static bool sameContents(const string& first, const string& second, int& error) {
+        error = 0;
+        int a = open(first.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        int b = open(second.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (a < 0 || b < 0) {
+            error = errno;
+            if (a >= 0) close(a);
+            if (b >= 0) close(b);
+            return false;
+        }
+        vector<char> bufferA(READ_BUFFER_SIZE), bufferB(READ_BUFFER_SIZE);
+        bool same = true;
+        for (off_t offset = 0; same;) {
+            ssize_t gotA = pread(a, bufferA.data(), bufferA.size(), offset);
+            ssize_t gotB = pread(b, bufferB.data(), bufferB.size(), offset);
+            if (gotA < 0 || gotB < 0) {
+                error = errno;
+                same = false;
+            } else if (gotA != gotB || memcmp(bufferA.data(), bufferB.data(), gotA) != 0) {
+                same = false;
+            } else if (gotA == 0) {
+                break;
+            }
+            offset += gotA;
+        }
+        close(a);
+        close(b);
+        return same;
+    }
+
+    // Replaces every file of 'set' but the first with a hard link to (or a
+    // reflinked copy of) the first. Each file is compared byte for byte
+    // first, and swapped in with rename() so it is never missing. Returns
+    // the number of files replaced.
+    static size_t replaceWithLinks(const DuplicateSet& set, LinkMode mode,
+                                   vector<pair<string, string>>& errors) {
+        const string& keep = set.paths[0];
+        size_t replaced = 0;
+        for (size_t i = 1; i < set.paths.size(); i++) {
+            const string& target = set.paths[i];
+            struct stat keepStat, targetStat;
+            if (countedStat(AT_FDCWD, keep.c_str(), &keepStat, AT_SYMLINK_NOFOLLOW) != 0
+                || countedStat(AT_FDCWD, target.c_str(), &targetStat, AT_SYMLINK_NOFOLLOW) != 0) {
+                errors.push_back(make_pair(target, strerror(errno)));
+                continue;
+            }
+            if (keepStat.st_dev == targetStat.st_dev && keepStat.st_ino == targetStat.st_ino) continue;
+            int error;
+            if (!S_ISREG(targetStat.st_mode) || targetStat.st_size != keepStat.st_size
+                || !sameContents(keep, target, error)) {
+                errors.push_back(make_pair(target, "Changed since it was scanned; left alone"));
+                continue;
+            }
+            // A hard link shares the kept file's inode, so it would take on
+            // its permissions and owner: a private copy could become public
+            if (mode == LINK_HARD && ((keepStat.st_mode & 07777) != (targetStat.st_mode & 07777)
+                                      || keepStat.st_uid != targetStat.st_uid
+                                      || keepStat.st_gid != targetStat.st_gid)) {
+                errors.push_back(make_pair(target, "Permissions or owner differ from " + keep + "; left alone"));
+                continue;
+            }
+
+            string temporary = target + ".fe-dedup";
+            bool ok;
+            if (mode == LINK_HARD) {
+                ok = link(keep.c_str(), temporary.c_str()) == 0;
+            } else {
+                int srcFd = open(keep.c_str(), O_RDONLY | O_CLOEXEC);
+                int destFd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                                  targetStat.st_mode & 07777);
+                ok = srcFd >= 0 && destFd >= 0 && ioctl(destFd, FICLONE, srcFd) == 0;
+                int savedErrno = errno;
+                if (ok) {
+                    // The reflinked copy keeps the replaced file's metadata
+                    fchmod(destFd, targetStat.st_mode & 07777);
+                    if (fchown(destFd, targetStat.st_uid, targetStat.st_gid) != 0) {
+                        // Keeping ownership needs privileges; the contents are what matter
+                    }
+                    struct timespec times[2] = {targetStat.st_atim, targetStat.st_mtim};
+                    futimens(destFd, times);
+                }
+                if (srcFd >= 0) close(srcFd);
+                if (destFd >= 0 && close(destFd) != 0) ok = false;
+                if (!ok && destFd >= 0) unlink(temporary.c_str());
+                errno = savedErrno;
+            }
+            if (!ok || rename(temporary.c_str(), target.c_str()) != 0) {
+                errors.push_back(make_pair(target, strerror(errno)));
+                if (ok) unlink(temporary.c_str());
+                continue;
+            }
+            replaced++;
+        }
+        return replaced;
+    }
+};
+
+// Helper class that formats output into one reusable buffer and writes it
+// to a file descriptor with few, large write() calls instead of a flushed
+// iostream line per row. Color codes are dropped when the descriptor is
+// not a terminal (e.g. when the listing is piped to a file).
+class OutputBuffer {
+public:
+    static const size_t FLUSH_THRESHOLD = 256 * 1024;
+
+private:
+    int fd;
+    string buffer;
+    bool colors;
+
+public:
+    explicit OutputBuffer(int outputFd = STDOUT_FILENO)
+        : fd(outputFd), colors(useColors(outputFd)) {
+        buffer.reserve(FLUSH_THRESHOLD + 4096);
+    }
+
+    ~OutputBuffer() {
+        flush();
+    }
+
+    // Colors are used only on terminals; stdout shares the check with
+    // cout's color codes, other descriptors are checked per buffer
+    static bool useColors(int outputFd) {
+        return outputFd == STDOUT_FILENO ? stdoutColors() : isatty(outputFd) == 1;
+    }
+
+    OutputBuffer& append(const char* text, size_t length) {
+        buffer.append(text, length);
+        if (buffer.size() >= FLUSH_THRESHOLD) flush();
+        return *this;
+    }
+
+    OutputBuffer& append(const string& text) {
+        return append(text.data(), text.size());
+    }
+
+    OutputBuffer& append(const char* text) {
+        return append(text, strlen(text));
+    }
+
+    OutputBuffer& append(char c) {
+        buffer.push_back(c);
+        if (buffer.size() >= FLUSH_THRESHOLD) flush();
+        return *this;
+    }
+
+    OutputBuffer& appendNumber(unsigned long long value) {
+        char digits[24];
+        int length = snprintf(digits, sizeof(digits), "%llu", value);
+        return append(digits, length);
+    }
+
+    // Left-aligned in a field of 'width' columns, like setw() with left
+    OutputBuffer& appendPadded(const char* text, size_t length, size_t width) {
+        buffer.append(text, length);
+        if (length < width) buffer.append(width - length, ' ');
+        if (buffer.size() >= FLUSH_THRESHOLD) flush();
+        return *this;
+    }
+
+    OutputBuffer& appendPadded(const string& text, size_t width) {
+        return appendPadded(text.data(), text.size(), width);
+    }
+
+    OutputBuffer& repeat(char c, size_t count) {
+        buffer.append(count, c);
+        return *this;
+    }
+
+    // Append an escape sequence such as RED, or nothing without colors
+    OutputBuffer& color(const char* code) {
+        if (colors) buffer.append(code);
+        return *this;
+    }
+
+    void flush() {
+        if (buffer.empty()) return;
+        // Keep ordering with anything still pending in cout
+        cout.flush();
+        size_t done = 0;
+        while (done < buffer.size()) {
+            ssize_t n = write(fd, buffer.data() + done, buffer.size() - done);
+            Profiler::instance().count(COUNTER_OUTPUT_WRITES);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        Profiler::instance().count(COUNTER_OUTPUT_BYTES, done);
+        buffer.clear();
+    }
+};
+
+// Helper function returning the length of the well-formed UTF-8 sequence
+// starting at text[i], or 0 if the bytes there are not valid UTF-8
+// (stray continuation byte, overlong form, surrogate or truncated)
+static size_t utf8SequenceLength(const string& text, size_t i) {
+    unsigned char lead = text[i];
+    size_t length;
+    uint32_t codePoint, minimum;
+    if (lead < 0x80) return 1;
+    if ((lead & 0xE0) == 0xC0) { length = 2; codePoint = lead & 0x1F; minimum = 0x80; }
+    else if ((lead & 0xF0) == 0xE0) { length = 3; codePoint = lead & 0x0F; minimum = 0x800; }
+    else if ((lead & 0xF8) == 0xF0) { length = 4; codePoint = lead & 0x07; minimum = 0x10000; }
+    else return 0;
+    if (i + length > text.size()) return 0;
+    for (size_t k = 1; k < length; k++) {
+        unsigned char next = text[i + k];
+        if ((next & 0xC0) != 0x80) return 0;
+        codePoint = (codePoint << 6) | (next & 0x3F);
+    }
+    if (codePoint < minimum || codePoint > 0x10FFFF
+        || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) return 0;
+    return length;
+}
+
+// Helper function returning how much of 'text' can be cut off without
+// splitting a multi-byte UTF-8 character that is still being written
+static size_t utf8CutPoint(const string& text) {
+    size_t size = text.size();
+    for (size_t back = 1; back <= 3 && back <= size; back++) {
+        unsigned char c = text[size - back];
+        if ((c & 0xC0) == 0x80) continue;
+        size_t expected = (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+        return expected > back ? size - back : size;
+    }
+    return size;
+}
+
+// Helper class that redirects stdout (cout and OutputBuffer's write()
+// calls alike) into a pipe while a command runs. A reader thread hands the
+// text to 'sink' in line-aligned chunks as it arrives, so scripted mode can
+// wrap large output without holding all of it; forward() writes to the
+// real stdout meanwhile.
+class OutputCapture {
+public:
+    static const size_t MAX_CHUNK = 1024 * 1024;
+
+private:
+    function<void(const string&)> sink;
+    int savedFd;
+    int readFd;
+    thread reader;
+
+    void readLoop() {
+        vector<char> block(64 * 1024);
+        string pending;
+        for (;;) {
+            ssize_t n = read(readFd, block.data(), block.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            pending.append(block.data(), n);
+            size_t lineEnd = pending.find_last_of('\n');
+            if (lineEnd != string::npos && pending.size() < MAX_CHUNK) {
+                sink(pending.substr(0, lineEnd + 1));
+                pending.erase(0, lineEnd + 1);
+            } else if (pending.size() >= MAX_CHUNK) {
+                // No newline to cut at: keep a partial character for later
+                size_t cut = utf8CutPoint(pending);
+                sink(pending.substr(0, cut));
+                pending.erase(0, cut);
+            }
+        }
+        if (!pending.empty()) sink(pending);
+    }
+
+public:
+    explicit OutputCapture(const function<void(const string&)>& chunkSink)
+        : sink(chunkSink), savedFd(-1), readFd(-1) {}
+
+    ~OutputCapture() {
+        end();
+    }
+
+    bool begin() {
+        if (savedFd >= 0) return false;
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) return false;
+        cout.flush();
+        savedFd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        if (savedFd < 0 || dup2(fds[1], STDOUT_FILENO) < 0) {
+            if (savedFd >= 0) close(savedFd);
+            savedFd = -1;
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+        close(fds[1]);
+        refreshStdoutColors();
+        readFd = fds[0];
+        reader = thread(&OutputCapture::readLoop, this);
+        return true;
+    }
+
+    // Restores stdout; returns once the sink has seen everything written
+    void end() {
+        if (savedFd < 0) return;
+        cout.flush();
+        // The pipe's last write end goes away here, so the reader sees EOF
+        dup2(savedFd, STDOUT_FILENO);
+        refreshStdoutColors();
+        reader.join();
+        close(readFd);
+        close(savedFd);
+        readFd = -1;
+        savedFd = -1;
+    }
+
+    // Writes to the stdout in place before begin(); for the sink
+    void forward(const string& text) {
+        int fd = savedFd >= 0 ? savedFd : STDOUT_FILENO;
+        size_t done = 0;
+        while (done < text.size()) {
+            ssize_t n = write(fd, text.data() + done, text.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+    }
+};
+
+// Helper function to drop "\033[...m" color sequences from captured text
+static string stripColors(const string& text) {
+    string plain;
+    plain.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '\033' && i + 1 < text.size() && text[i + 1] == '[') {
+            size_t end = text.find('m', i + 2);
+            if (end != string::npos) {
+                i = end;
+                continue;
+            }
+        }
+        plain += text[i];
+    }
+    return plain;
+}
+
+// Helper function to append 'text' as a quoted JSON string; bytes that are
+// not valid UTF-8 (e.g. from a non-UTF-8 file name) become U+FFFD, so the
+// line always parses but such names do not round-trip
+static void appendJsonString(string& out, const string& text) {
+    out += '"';
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = text[i];
+        if (c >= 0x80) {
+            size_t length = utf8SequenceLength(text, i);
+            if (length == 0) {
+                out += "\\ufffd";
+            } else {
+                out.append(text, i, length);
+                i += length - 1;
+            }
+            continue;
+        }
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char code[8];
+                    snprintf(code, sizeof(code), "\\u%04x", c);
+                    out += code;
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    out += '"';
+}
+
+// Helper function returning the "rwxr-xr-x" text for the 9 permission bits
+static const char* permissionText(mode_t mode) {
+    struct Table {
+        char text[512][10];
+
+        Table() {
+            const char letters[] = "rwxrwxrwx";
+            for (int bits = 0; bits < 512; bits++) {
+                for (int i = 0; i < 9; i++) {
+                    text[bits][i] = (bits & (0400 >> i)) ? letters[i] : '-';
+                }
+                text[bits][9] = '\0';
+            }
+        }
+    };
+    static const Table table;
+    return table.text[mode & 0777];
+}
+
+// Helper class that formats "YYYY-MM-DD HH:MM:SS" local times, caching the
+// text per second in a small direct-mapped table so rows sharing an mtime
+// (extracted archives, build outputs) skip localtime_r() entirely
+class TimestampCache {
+public:
+    static const size_t SLOTS = 4096;
+    static const size_t TEXT_LENGTH = 19;
+
+private:
+    struct Slot {
+        time_t seconds;
+        bool valid;
+        char text[TEXT_LENGTH + 1];
+    };
+    vector<Slot> slots;
+
+    static void putDigits(char* out, int value, int width) {
+        for (int i = width - 1; i >= 0; i--) {
+            out[i] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+    }
+
+public:
+    TimestampCache() : slots(SLOTS) {
+        for (auto& slot : slots) slot.valid = false;
+    }
+
+    const char* format(time_t seconds) {
+        Slot& slot = slots[static_cast<size_t>(seconds) % SLOTS];
+        if (slot.valid && slot.seconds == seconds) return slot.text;
+
+        struct tm parts;
+        if (localtime_r(&seconds, &parts) == NULL) {
+            memset(&parts, 0, sizeof(parts));
+        }
+        char* out = slot.text;
+        putDigits(out, parts.tm_year + 1900, 4);
+        out[4] = '-';
+        putDigits(out + 5, parts.tm_mon + 1, 2);
+        out[7] = '-';
+        putDigits(out + 8, parts.tm_mday, 2);
+        out[10] = ' ';
+        putDigits(out + 11, parts.tm_hour, 2);
+        out[13] = ':';
+        putDigits(out + 14, parts.tm_min, 2);
+        out[16] = ':';
+        putDigits(out + 17, parts.tm_sec, 2);
+        out[TEXT_LENGTH] = '\0';
+        slot.seconds = seconds;
+        slot.valid = true;
+        return slot.text;
+    }
+};
 
 class FileExplorer {
 private:
     string currentPath;
-    vector<string> fileList;
+    DirSnapshot listing;    // entries of the last listing or page shown
+    unsigned metadataThreads;
+    unique_ptr<WorkerPool> workerPool;
+    unique_ptr<WorkerPool> copyPool;
+    unique_ptr<NameIndex> nameIndex;
+    unique_ptr<IndexWatcher> indexWatcher;  // declared after nameIndex: stops first
+    TimestampCache timestamps;
+    unique_ptr<DirectoryPager> pager;   // active paged listing, if any
+    size_t pageSize;
+    bool pagerDetailed;
+    string traceFile;
+    bool interactive;  // false while running a script: never prompt
+    DiskUsageScanner diskUsageScanner;  // keeps per-directory totals between calls
+    DirSnapshotCache snapshotCache;     // unchanged directories re-list without a scan
+    size_t errorCount;                  // errors reported so far; scripted mode compares it
     
-    // Helper function to get file permissions string
-    string getPermissionsString(mode_t mode) {
-        string perms = "";
-        
-        // File type
-        if (S_ISDIR(mode)) perms += "d";
-        else if (S_ISLNK(mode)) perms += "l";
-        else perms += "-";
+    // Helper function to start an "Error: ..." line; it is counted so
+    // scripted mode knows the command failed without parsing its output
+    ostream& reportError() {
+        errorCount++;
+        return cout << RED << "Error: ";
+    }
+    
+    // Helper function to print the listing title and column header
+    void appendListingHeader(OutputBuffer& out, bool detailed) {
+        out.append('\n').color(BOLD).color(CYAN).append("Current Directory: ").append(currentPath)
+           .color(RESET).append('\n').repeat('=', 80).append('\n');
         
-        // Owner permissions
-        perms += (mode & S_IRUSR) ? "r" : "-";
-        perms += (mode & S_IWUSR) ? "w" : "-";
-        perms += (mode & S_IXUSR) ? "x" : "-";
+        if (detailed) {
+            out.appendPadded("Permissions", 11, 12).appendPadded("Owner", 5, 10)
+               .appendPadded("Group", 5, 10).appendPadded("Size", 4, 12)
+               .appendPadded("Modified", 8, 20).append("Name\n").repeat('-', 80).append('\n');
+        }
+    }
+    
+    // Helper function to print one listing row
+    void appendListingRow(OutputBuffer& out, const DirSnapshot& snapshot, size_t index, bool detailed) {
+        const DirSnapshot::Entry& entry = snapshot.record(index);
+        const char* filename = snapshot.name(index);
+        if (detailed) {
+            // Get owner and group names
+            string owner = IdNameCache::instance().userName(entry.uid);
+            string group = IdNameCache::instance().groupName(entry.gid);
+            
+            char perms[11];
+            perms[0] = S_ISDIR(entry.mode) ? 'd' : (S_ISLNK(entry.mode) ? 'l' : '-');
+            memcpy(perms + 1, permissionText(entry.mode), 10);
+            char sizeText[32];
+            size_t sizeLength = formatFileSizeInto(sizeText, sizeof(sizeText), entry.size);
+            
+            out.appendPadded(perms, 10, 12)
+               .appendPadded(owner, 10)
+               .appendPadded(group, 10)
+               .appendPadded(sizeText, sizeLength, 12)
+               .appendPadded(timestamps.format(static_cast<time_t>(entry.mtime)),
+                             TimestampCache::TEXT_LENGTH, 20);
+        }
         
-        // Group permissions
-        perms += (mode & S_IRGRP) ? "r" : "-";
-        perms += (mode & S_IWGRP) ? "w" : "-";
-        perms += (mode & S_IXGRP) ? "x" : "-";
+        // The executable marker needs a stat record, so the simple view
+        // (which relies on d_type) only shows it for stat'ed entries
+        if (snapshot.isDirectory(index)) {
+            out.color(BLUE).color(BOLD).append(filename, entry.nameLength).append('/');
+        } else if (entry.hasStat && (entry.mode & S_IXUSR)) {
+            out.color(GREEN).append(filename, entry.nameLength).append('*');
+        } else {
+            out.color(WHITE).append(filename, entry.nameLength);
+        }
+        out.color(RESET).append('\n');
+    }
+    
+    // Helper function to load and print one page of the active pager;
+    // the listing snapshot holds just the entries on screen
+    void showPage(size_t page) {
+        DirSnapshot& entries = listing;
+        if (!pager->load(page, pagerDetailed, entries)) {
+            reportError() << "Cannot read page " << (page + 1) << " of the directory!" << RESET << endl;
+            return;
+        }
         
-        // Other permissions
-        perms += (mode & S_IROTH) ? "r" : "-";
-        perms += (mode & S_IWOTH) ? "w" : "-";
-        perms += (mode & S_IXOTH) ? "x" : "-";
+        ScopedPhase timer(PHASE_RENDER);
+        OutputBuffer out;
+        appendListingHeader(out, pagerDetailed);
+        for (uint32_t index : entries.order()) {
+            appendListingRow(out, entries, index, pagerDetailed);
+        }
         
-        return perms;
+        size_t first = page * pager->getPageSize();
+        out.append("\nPage ").appendNumber(page + 1).append(" (items ")
+           .appendNumber(entries.empty() ? 0 : first + 1).append('-').appendNumber(first + entries.size());
+        if (pager->getOrder() == DirectoryPager::SORTED) {
+            out.append(" of ").appendNumber(pager->knownTotal());
+        } else {
+            out.append(", directory order");
+        }
+        out.append(")").append(pager->isLastPage() ? " - last page\n" : " - more with next page\n");
     }
     
-    // Helper function to format file size
-    string formatFileSize(off_t size) {
+    // Helper function to format file size into a caller buffer; returns
+    // the length written
+    static size_t formatFileSizeInto(char* buffer, size_t capacity, off_t size) {
         const char* units[] = {"B", "KB", "MB", "GB", "TB"};
         int unitIndex = 0;
         double dSize = size;
@@ -68,25 +5689,338 @@ private:
             unitIndex++;
         }
         
-        char buffer[50];
+        int length;
         if (unitIndex == 0) {
-            snprintf(buffer, sizeof(buffer), "%ld %s", size, units[unitIndex]);
+            length = snprintf(buffer, capacity, "%ld %s", size, units[unitIndex]);
+        } else {
+            length = snprintf(buffer, capacity, "%.2f %s", dSize, units[unitIndex]);
+        }
+        return length < 0 ? 0 : min(static_cast<size_t>(length), capacity - 1);
+    }
+    
+    // Helper function to format file size
+    string formatFileSize(off_t size) {
+        char buffer[50];
+        size_t length = formatFileSizeInto(buffer, sizeof(buffer), size);
+        return string(buffer, length);
+    }
+    
+    // Helper function to get the shared worker pool, (re)created on demand
+    WorkerPool* getWorkerPool() {
+        if (!workerPool || workerPool->size() != metadataThreads) {
+            workerPool.reset(new WorkerPool(metadataThreads));
+        }
+        return workerPool.get();
+    }
+    
+    // Helper function to get the pool used for tree copies, sized for the
+    // destination device
+    WorkerPool* getCopyPool(const string& destPath) {
+        unsigned threads = ParallelTreeCopier::suggestedThreads(destPath);
+        if (!copyPool || copyPool->size() != threads) {
+            copyPool.reset(new WorkerPool(threads));
+        }
+        return copyPool.get();
+    }
+    
+    // Helper function to resolve a path to its canonical form
+    static string canonicalPath(const string& path) {
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved) == NULL) {
+            return path;
+        }
+        return string(resolved);
+    }
+    
+    // Helper function to find the name index covering 'path' (canonical):
+    // the index of the path itself or of its nearest indexed ancestor
+    NameIndex* findNameIndex(const string& path) {
+        if (nameIndex && nameIndex->isCurrent()) {
+            string root = nameIndex->getRoot();
+            if (path == root || root == "/"
+                || (path.compare(0, root.size(), root) == 0 && path[root.size()] == '/')) {
+                return nameIndex.get();
+            }
+        }
+        
+        string candidate = path;
+        for (;;) {
+            if (access(NameIndex::indexPathFor(candidate).c_str(), R_OK) == 0) {
+                unique_ptr<NameIndex> index(new NameIndex());
+                if (index->load(candidate)) {
+                    // Keep the newly loaded index current in the background
+                    indexWatcher.reset();
+                    nameIndex = move(index);
+                    indexWatcher.reset(new IndexWatcher(*nameIndex));
+                    if (!indexWatcher->start()) {
+                        indexWatcher.reset();
+                    }
+                    return nameIndex.get();
+                }
+            }
+            if (candidate == "/") return NULL;
+            size_t slash = candidate.find_last_of('/');
+            candidate = (slash == 0 || slash == string::npos) ? "/" : candidate.substr(0, slash);
+        }
+    }
+    
+    // Helper function to map a full path to its path relative to the loaded
+    // name index; false if no index is loaded or the path is outside it
+    bool indexRelativePath(const string& fullPath, string& relative) {
+        if (!nameIndex) {
+            return false;
+        }
+        string trimmed = fullPath;
+        while (trimmed.size() > 1 && trimmed[trimmed.size() - 1] == '/') {
+            trimmed.erase(trimmed.size() - 1);
+        }
+        size_t slash = trimmed.find_last_of('/');
+        if (slash == string::npos) {
+            return false;
+        }
+        
+        // The entry itself may already be gone, so only resolve its parent
+        string parent = canonicalPath(slash == 0 ? "/" : trimmed.substr(0, slash));
+        string canonical = (parent == "/" ? "" : parent) + "/" + trimmed.substr(slash + 1);
+        string root = nameIndex->getRoot();
+        if (root == "/") {
+            relative = canonical.substr(1);
+            return true;
+        }
+        if (canonical.size() <= root.size() || canonical.compare(0, root.size(), root) != 0
+            || canonical[root.size()] != '/') {
+            return false;
+        }
+        relative = canonical.substr(root.size() + 1);
+        return true;
+    }
+    
+    // Helper functions to apply the explorer's own changes to the name
+    // index directly instead of waiting for the watcher
+    void indexNoteCreated(const string& fullPath, bool isDir) {
+        string relative;
+        if (indexRelativePath(fullPath, relative)) {
+            if (isDir) {
+                nameIndex->noteCreatedTree(relative);
+            } else {
+                nameIndex->noteCreated(relative, false);
+            }
+        }
+    }
+    
+    void indexNoteRemoved(const string& fullPath) {
+        string relative;
+        if (indexRelativePath(fullPath, relative)) {
+            nameIndex->noteRemoved(relative);
+        }
+    }
+    
+    // Helper function to turn a batch selector into items: "@file" reads
+    // one name per line, a glob is matched against the directory, anything
+    // else is a space-separated list of names
+    bool selectBatchItems(int dirFd, const string& selector, vector<BatchItem>& items, string& error) {
+        vector<string> names;
+        if (!selector.empty() && selector[0] == '@') {
+            ifstream list(selector.substr(1));
+            if (!list) {
+                error = "Cannot read list file " + selector.substr(1) + "!";
+                return false;
+            }
+            string line;
+            while (getline(list, line)) {
+                if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+                if (!line.empty()) names.push_back(line);
+            }
+        } else if (selector.find_first_of("*?[") != string::npos) {
+            int scanFd = dup(dirFd);
+            if (scanFd < 0 || lseek(scanFd, 0, SEEK_SET) < 0) {
+                if (scanFd >= 0) close(scanFd);
+                error = "Cannot read directory!";
+                return false;
+            }
+            DirReader reader(scanFd);
+            const char* name;
+            unsigned char type;
+            while (reader.next(name, type)) {
+                if (!isDotOrDotDot(name) && fnmatch(selector.c_str(), name, FNM_PERIOD) == 0) {
+                    names.push_back(name);
+                }
+            }
+            close(scanFd);
+            sort(names.begin(), names.end());
         } else {
-            snprintf(buffer, sizeof(buffer), "%.2f %s", dSize, units[unitIndex]);
+            istringstream list(selector);
+            string name;
+            while (list >> name) names.push_back(name);
+        }
+        
+        items.resize(names.size());
+        for (size_t i = 0; i < names.size(); i++) {
+            items[i].name.swap(names[i]);
+        }
+        return true;
+    }
+    
+    // Helper function to apply a batch operation's argument
+    bool configureBatch(BatchOperation op, const string& argument, BatchRunner& runner,
+                        vector<BatchItem>& items, string& error) {
+        switch (op) {
+        case BATCH_DELETE:
+            runner.setRecursive(argument == "-r");
+            return true;
+        case BATCH_RENAME: {
+            if (argument.empty()) {
+                error = "Rename needs a new-name template or a target directory!";
+                return false;
+            }
+            bool templated = argument.find("{}") != string::npos;
+            struct stat targetStat;
+            string targetDir = argument[0] == '/' ? argument : currentPath + "/" + argument;
+            bool intoDirectory = !templated && countedStat(AT_FDCWD, targetDir.c_str(), &targetStat, 0) == 0
+                                 && S_ISDIR(targetStat.st_mode);
+            if (!templated && !intoDirectory) {
+                // A plain new name only makes sense for a single item
+                if (items.size() != 1) {
+                    error = "'" + argument + "' is neither a template with {} nor a directory!";
+                    return false;
+                }
+                items[0].target = argument;
+                return true;
+            }
+            for (auto& item : items) {
+                if (templated) {
+                    item.target = argument;
+                    for (size_t at = item.target.find("{}"); at != string::npos;
+                         at = item.target.find("{}", at + item.name.size())) {
+                        item.target.replace(at, 2, item.name);
+                    }
+                } else {
+                    size_t slash = item.name.find_last_of('/');
+                    item.target = argument + "/" + (slash == string::npos ? item.name : item.name.substr(slash + 1));
+                }
+            }
+            return true;
+        }
+        case BATCH_CHMOD: {
+            char* end = NULL;
+            long mode = strtol(argument.c_str(), &end, 8);
+            if (argument.empty() || *end != '\0' || mode < 0 || mode > 07777) {
+                error = "Invalid octal mode '" + argument + "'!";
+                return false;
+            }
+            runner.setMode(static_cast<mode_t>(mode));
+            return true;
+        }
+        case BATCH_CHOWN: {
+            size_t colon = argument.find(':');
+            string user = argument.substr(0, colon);
+            string group = colon == string::npos ? "" : argument.substr(colon + 1);
+            uid_t uid = static_cast<uid_t>(-1);
+            gid_t gid = static_cast<gid_t>(-1);
+            if (user.empty() && group.empty()) {
+                error = "Chown needs user[:group]!";
+                return false;
+            }
+            if (!user.empty() && !IdNameCache::instance().userId(user, uid)) {
+                char* end = NULL;
+                unsigned long id = strtoul(user.c_str(), &end, 10);
+                if (*end != '\0') {
+                    error = "Unknown user '" + user + "'!";
+                    return false;
+                }
+                uid = static_cast<uid_t>(id);
+            }
+            if (!group.empty() && !IdNameCache::instance().groupId(group, gid)) {
+                char* end = NULL;
+                unsigned long id = strtoul(group.c_str(), &end, 10);
+                if (*end != '\0') {
+                    error = "Unknown group '" + group + "'!";
+                    return false;
+                }
+                gid = static_cast<gid_t>(id);
+            }
+            runner.setOwner(uid, gid);
+            return true;
+        }
+        default:
+            return true;
+        }
+    }
+    
+    // Helper function to search names by walking the tree below basePath.
+    // Names are matched in the getdents buffer; a path string is only built
+    // for matches and for directories still to visit. Symlinks are not
+    // followed.
+    void crawlNames(const string& basePath, const NameMatcher& matcher, vector<string>& results) {
+        vector<string> pending(1, basePath);
+        while (!pending.empty()) {
+            string dirPath = move(pending.back());
+            pending.pop_back();
+            int dirFd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (dirFd < 0) {
+                continue;
+            }
+            
+            size_t firstSubdir = pending.size();
+            DirReader reader(dirFd);
+            const char* name;
+            unsigned char type;
+            while (reader.next(name, type)) {
+                if (isDotOrDotDot(name)) continue;
+                if (type == DT_UNKNOWN) {
+                    struct stat entryStat;
+                    if (countedStat(dirFd, name, &entryStat, AT_SYMLINK_NOFOLLOW) == 0) {
+                        type = S_ISDIR(entryStat.st_mode) ? DT_DIR : DT_REG;
+                    }
+                }
+                bool isMatch = matcher.matches(name);
+                if (isMatch || type == DT_DIR) {
+                    string fullPath = dirPath + "/" + name;
+                    if (type == DT_DIR) pending.push_back(fullPath);
+                    if (isMatch) results.push_back(move(fullPath));
+                }
+            }
+            close(dirFd);
+            reverse(pending.begin() + firstSubdir, pending.end());
         }
-        return string(buffer);
     }
     
-    // Helper function to get file modification time
-    string getModificationTime(time_t mtime) {
-        char buffer[100];
-        struct tm* timeinfo = localtime(&mtime);
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
-        return string(buffer);
+    // Helper function to answer a name search from the index; returns false
+    // when no index covers 'basePath' so the caller falls back to a crawl
+    bool searchNameIndex(const string& basePath, const string& searchTerm, vector<string>& results) {
+        string canonical = canonicalPath(basePath);
+        NameIndex* index = findNameIndex(canonical);
+        if (index == NULL) {
+            return false;
+        }
+        
+        string root = index->getRoot();
+        string subPath;
+        if (canonical.size() > root.size()) {
+            subPath = canonical.substr(root == "/" ? 1 : root.size() + 1);
+        }
+        vector<string> relative;
+        index->query(subPath, NameMatcher::fromSearchTerm(searchTerm),
+                     metadataThreads > 1 ? getWorkerPool() : NULL, relative);
+        
+        // Report paths under basePath as given, like the crawl does
+        size_t skip = subPath.empty() ? 0 : subPath.size() + 1;
+        for (const auto& path : relative) {
+            results.push_back(basePath + "/" + path.substr(skip));
+        }
+        return true;
     }
 
 public:
     FileExplorer() {
+        // Stat calls on network filesystems are latency bound, so use more
+        // threads than cores by default
+        metadataThreads = max(8u, 2 * thread::hardware_concurrency());
+        pageSize = 50;
+        pagerDetailed = false;
+        interactive = true;
+        errorCount = 0;
+        
         char cwd[1024];
         if (getcwd(cwd, sizeof(cwd)) != NULL) {
             currentPath = string(cwd);
@@ -95,79 +6029,236 @@ public:
         }
     }
     
-    // DAY 1: Basic file operations - List files in directory
-    void listFiles(bool detailed = false) {
-        fileList.clear();
-        DIR* dir = opendir(currentPath.c_str());
+    // Set how many threads fetch metadata for detailed listings (1 = serial)
+    void setMetadataThreads(unsigned count) {
+        metadataThreads = max(1u, count);
+    }
+    
+    unsigned getMetadataThreads() const {
+        return metadataThreads;
+    }
+    
+    // Show how well the owner/group name cache is doing
+    void showNameCacheStats() {
+        IdNameCache& cache = IdNameCache::instance();
+        unsigned long hits = cache.hits();
+        unsigned long misses = cache.misses();
+        unsigned long total = hits + misses;
         
-        if (dir == NULL) {
-            cout << RED << "Error: Cannot open directory!" << RESET << endl;
+        cout << BOLD << CYAN << "Owner/group name cache" << RESET << endl;
+        cout << "  Entries : " << cache.size() << endl;
+        cout << "  Hits    : " << hits << endl;
+        cout << "  Misses  : " << misses << endl;
+        
+        char rate[16];
+        snprintf(rate, sizeof(rate), "%.1f%%", total ? 100.0 * hits / total : 0.0);
+        cout << "  Hit rate: " << rate << endl;
+    }
+    
+    // Turns the per-phase timers and counters on or off. With 'tracePath'
+    // set, phase spans are also recorded and stopStatsTrace() writes them
+    // there as a Chrome trace (chrome://tracing, Perfetto).
+    void setStatsEnabled(bool enabled) {
+        Profiler::instance().setEnabled(enabled);
+        cout << GREEN << "Statistics " << (enabled ? "enabled" : "disabled") << RESET << endl;
+    }
+    
+    void startStatsTrace(const string& tracePath) {
+        traceFile = tracePath.empty() || tracePath[0] == '/' ? tracePath : currentPath + "/" + tracePath;
+        Profiler::instance().setTracing(true);
+        cout << GREEN << "Recording trace for " << traceFile << RESET << endl;
+    }
+    
+    void stopStatsTrace() {
+        Profiler& profiler = Profiler::instance();
+        if (!profiler.isTracing() || traceFile.empty()) {
+            cout << YELLOW << "No trace is being recorded." << RESET << endl;
+            return;
+        }
+        profiler.setTracing(false);
+        string error;
+        if (!profiler.writeChromeTrace(traceFile, error)) {
+            reportError() << "Cannot write trace: " << error << RESET << endl;
             return;
         }
+        cout << GREEN << "Wrote " << profiler.traceEventCount() << " span(s) to " << traceFile << RESET << endl;
+        if (profiler.droppedTraceEvents() > 0) {
+            cout << YELLOW << profiler.droppedTraceEvents() << " span(s) beyond the "
+                 << Profiler::MAX_TRACE_EVENTS << " limit were dropped" << RESET << endl;
+        }
+    }
+    
+    void resetStats() {
+        Profiler::instance().reset();
+        cout << GREEN << "Statistics reset" << RESET << endl;
+    }
+    
+    // Aggregated phase timings and counters since statistics were enabled
+    // or last reset
+    void showStats() {
+        Profiler& profiler = Profiler::instance();
+        if (!profiler.isEnabled()) {
+            cout << YELLOW << "Statistics are disabled; enable them first." << RESET << endl;
+        }
         
-        struct dirent* entry;
-        vector<pair<string, bool>> entries; // pair<name, isDirectory>
+        cout << BOLD << CYAN << "Phase          Calls     Total ms    Avg us" << RESET << endl;
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            ProfilePhase phase = static_cast<ProfilePhase>(i);
+            uint64_t calls = profiler.phaseCallCount(phase);
+            if (calls == 0) continue;
+            double totalMs = profiler.phaseNanoseconds(phase) / 1e6;
+            char row[96];
+            snprintf(row, sizeof(row), "%-12s %7llu %12.3f %9.1f", Profiler::phaseName(phase),
+                     static_cast<unsigned long long>(calls), totalMs, totalMs * 1000.0 / calls);
+            cout << row << endl;
+        }
         
-        while ((entry = readdir(dir)) != NULL) {
-            string filename = entry->d_name;
-            string fullPath = currentPath + "/" + filename;
-            struct stat fileStat;
-            
-            if (stat(fullPath.c_str(), &fileStat) == 0) {
-                bool isDir = S_ISDIR(fileStat.st_mode);
-                entries.push_back(make_pair(filename, isDir));
-            }
+        cout << "\n" << BOLD << CYAN << "Counters" << RESET << endl;
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            ProfileCounter counter = static_cast<ProfileCounter>(i);
+            cout << "  " << left << setw(18) << Profiler::counterName(counter)
+                 << profiler.counterValue(counter) << endl;
         }
-        closedir(dir);
         
-        // Sort: directories first, then files
-        sort(entries.begin(), entries.end(), [](const pair<string, bool>& a, const pair<string, bool>& b) {
-            if (a.second != b.second) return a.second > b.second;
-            return a.first < b.first;
-        });
+        IdNameCache& names = IdNameCache::instance();
+        cout << "  " << left << setw(18) << "name cache hits" << names.hits() << endl;
+        cout << "  " << left << setw(18) << "snapshot hits" << snapshotCache.hits()
+             << " of " << snapshotCache.hits() + snapshotCache.misses() << " listings" << endl;
+        if (profiler.isTracing()) {
+            cout << CYAN << "Trace: " << profiler.traceEventCount() << " span(s) recorded for "
+                 << traceFile << RESET << endl;
+        }
+    }
+    
+    // How often listings were served from the directory snapshot cache
+    void showSnapshotCacheStats() {
+        unsigned long hits = snapshotCache.hits();
+        unsigned long misses = snapshotCache.misses();
+        unsigned long total = hits + misses;
         
-        cout << "\n" << BOLD << CYAN << "Current Directory: " << currentPath << RESET << "\n";
-        cout << string(80, '=') << endl;
+        cout << BOLD << CYAN << "Directory snapshot cache" << RESET << endl;
+        cout << "  Directories: " << snapshotCache.size() << endl;
+        cout << "  Memory     : " << formatFileSize(snapshotCache.memoryBytes()) << " of "
+             << formatFileSize(snapshotCache.getMemoryLimit()) << endl;
+        cout << "  Hits       : " << hits << endl;
+        cout << "  Misses     : " << misses << " (" << snapshotCache.staleEntries() << " changed since cached)" << endl;
+        cout << "  Evictions  : " << snapshotCache.evictions() << endl;
         
-        if (detailed) {
-            cout << left << setw(12) << "Permissions" << setw(10) << "Owner" 
-                 << setw(10) << "Group" << setw(12) << "Size" 
-                 << setw(20) << "Modified" << "Name" << endl;
-            cout << string(80, '-') << endl;
+        char rate[16];
+        snprintf(rate, sizeof(rate), "%.1f%%", total ? 100.0 * hits / total : 0.0);
+        cout << "  Hit rate   : " << rate << endl;
+    }
+    
+    // Cap the memory held by cached directory snapshots (0 disables caching)
+    void setSnapshotCacheLimit(size_t bytes) {
+        snapshotCache.setMemoryLimit(bytes);
+    }
+    
+    // Memory held by the snapshot of the last listing
+    void showListingStats() {
+        char perEntry[32];
+        snprintf(perEntry, sizeof(perEntry), "%.1f", listing.bytesPerEntry());
+        
+        cout << BOLD << CYAN << "Listing snapshot" << RESET << endl;
+        cout << "  Entries        : " << listing.recordCount() << endl;
+        cout << "  Memory (bytes) : " << listing.memoryBytes() << endl;
+        cout << "  Bytes per entry: " << perEntry
+             << " (record " << sizeof(DirSnapshot::Entry) << " + name + index)" << endl;
+    }
+    
+    // DAY 1: Basic file operations - List files in directory
+    // The default query sorts directories first, then by name
+    void listFiles(bool detailed = false, const ListingQuery& query = ListingQuery()) {
+        listing.clear();
+        
+        bool withStat = detailed || query.needsStat();
+        WorkerPool* pool = metadataThreads > 1 ? getWorkerPool() : NULL;
+        if (!snapshotCache.load(currentPath, withStat, listing, pool)) {
+            reportError() << "Cannot open directory!" << RESET << endl;
+            return;
+        }
+        
+        // Filter and sort. Only the index vector is permuted; records and
+        // names stay where the scan put them.
+        size_t scanned = listing.size();
+        {
+            ScopedPhase timer(PHASE_SORT);
+            query.apply(listing, pool);
+        }
+        
+        // Rows are formatted into one buffer and written in large blocks
+        ScopedPhase timer(PHASE_RENDER);
+        OutputBuffer out;
+        appendListingHeader(out, detailed);
+        for (uint32_t index : listing.order()) {
+            appendListingRow(out, listing, index, detailed);
+        }
+        out.append("\nTotal items: ").appendNumber(listing.size());
+        if (!query.isDefault()) {
+            out.append(" (of ").appendNumber(scanned).append(')');
+        }
+        out.append('\n');
+    }
+    
+    // DAY 1: Sorted/filtered listing, e.g. "sort=size reverse limit=100"
+    // or "type=f newer=1h name=*.log" (see ListingQuery::parse)
+    void listFilesWhere(const string& spec, bool detailed = true) {
+        ListingQuery query;
+        string error;
+        if (!ListingQuery::parse(spec, query, error)) {
+            reportError() << error << "!" << RESET << endl;
+            return;
+        }
+        listFiles(detailed, query);
+    }
+    
+    // DAY 1: Paged listing for huge directories - shows one page and keeps
+    // the directory open for nextPage()/prevPage()
+    void listFilesPaged(bool detailed = false, bool sorted = true) {
+        pager.reset(new DirectoryPager(currentPath,
+                                       sorted ? DirectoryPager::SORTED : DirectoryPager::DIRECTORY_ORDER,
+                                       pageSize));
+        pagerDetailed = detailed;
+        if (!pager->isOpen()) {
+            pager.reset();
+            reportError() << "Cannot open directory!" << RESET << endl;
+            return;
+        }
+        showPage(0);
+    }
+    
+    void nextPage() {
+        if (!pager) {
+            cout << YELLOW << "No paged listing active. List the directory in paged mode first." << RESET << endl;
+            return;
+        }
+        if (pager->isLastPage()) {
+            cout << YELLOW << "Already on the last page." << RESET << endl;
+            return;
         }
-        
-        for (const auto& entry : entries) {
-            string filename = entry.first;
-            string fullPath = currentPath + "/" + filename;
-            struct stat fileStat;
-            
-            if (stat(fullPath.c_str(), &fileStat) == 0) {
-                fileList.push_back(filename);
-                
-                if (detailed) {
-                    // Get owner and group names
-                    struct passwd* pw = getpwuid(fileStat.st_uid);
-                    struct group* gr = getgrgid(fileStat.st_gid);
-                    string owner = pw ? pw->pw_name : to_string(fileStat.st_uid);
-                    string group = gr ? gr->gr_name : to_string(fileStat.st_gid);
-                    
-                    cout << left << setw(12) << getPermissionsString(fileStat.st_mode)
-                         << setw(10) << owner
-                         << setw(10) << group
-                         << setw(12) << formatFileSize(fileStat.st_size)
-                         << setw(20) << getModificationTime(fileStat.st_mtime);
-                }
-                
-                if (S_ISDIR(fileStat.st_mode)) {
-                    cout << BLUE << BOLD << filename << "/" << RESET << endl;
-                } else if (fileStat.st_mode & S_IXUSR) {
-                    cout << GREEN << filename << "*" << RESET << endl;
-                } else {
-                    cout << WHITE << filename << RESET << endl;
-                }
-            }
+        showPage(pager->currentPage() + 1);
+    }
+    
+    void prevPage() {
+        if (!pager) {
+            cout << YELLOW << "No paged listing active. List the directory in paged mode first." << RESET << endl;
+            return;
         }
-        cout << "\nTotal items: " << fileList.size() << endl;
+        if (pager->currentPage() == 0) {
+            cout << YELLOW << "Already on the first page." << RESET << endl;
+            return;
+        }
+        showPage(pager->currentPage() - 1);
+    }
+    
+    void setPageSize(size_t entries) {
+        pageSize = max<size_t>(1, entries);
+        pager.reset();
+        cout << GREEN << "Page size set to " << pageSize << " entries" << RESET << endl;
+    }
+    
+    size_t getPageSize() const {
+        return pageSize;
     }
     
     // DAY 2: Navigation features
@@ -191,15 +6282,16 @@ public:
         }
         
         struct stat pathStat;
-        if (stat(newPath.c_str(), &pathStat) == 0 && S_ISDIR(pathStat.st_mode)) {
+        if (countedStat(AT_FDCWD, newPath.c_str(), &pathStat, 0) == 0 && S_ISDIR(pathStat.st_mode)) {
             currentPath = newPath;
+            pager.reset();
             if (chdir(currentPath.c_str()) == 0) {
                 cout << GREEN << "Changed directory to: " << currentPath << RESET << endl;
             } else {
-                cout << RED << "Error: Cannot access directory!" << RESET << endl;
+                reportError() << "Cannot access directory!" << RESET << endl;
             }
         } else {
-            cout << RED << "Error: Directory does not exist!" << RESET << endl;
+            reportError() << "Directory does not exist!" << RESET << endl;
         }
     }
     
@@ -214,9 +6306,10 @@ public:
         
         if (file.is_open()) {
             file.close();
+            indexNoteCreated(fullPath, false);
             cout << GREEN << "File created successfully: " << filename << RESET << endl;
         } else {
-            cout << RED << "Error: Cannot create file!" << RESET << endl;
+            reportError() << "Cannot create file!" << RESET << endl;
         }
     }
     
@@ -225,37 +6318,49 @@ public:
         string fullPath = currentPath + "/" + dirname;
         
         if (mkdir(fullPath.c_str(), 0755) == 0) {
+            indexNoteCreated(fullPath, true);
             cout << GREEN << "Directory created successfully: " << dirname << RESET << endl;
         } else {
-            cout << RED << "Error: Cannot create directory!" << RESET << endl;
+            reportError() << "Cannot create directory!" << RESET << endl;
         }
     }
     
     // DAY 3: Delete file or directory
-    void deleteItem(const string& name) {
+    // A non-empty directory is only removed when 'recursive' is set or the
+    // user confirms; scripted mode never prompts
+    void deleteItem(const string& name, bool recursive = false) {
         string fullPath = currentPath + "/" + name;
         struct stat pathStat;
         
-        if (stat(fullPath.c_str(), &pathStat) != 0) {
-            cout << RED << "Error: Item does not exist!" << RESET << endl;
+        if (countedStat(AT_FDCWD, fullPath.c_str(), &pathStat, 0) != 0) {
+            reportError() << "Item does not exist!" << RESET << endl;
             return;
         }
         
         if (S_ISDIR(pathStat.st_mode)) {
             // Try simple rmdir first (for empty directories)
             if (rmdir(fullPath.c_str()) == 0) {
+                indexNoteRemoved(fullPath);
                 cout << GREEN << "Directory deleted successfully: " << name << RESET << endl;
             } else {
                 // Directory is not empty, ask user
-                cout << YELLOW << "Directory is not empty. Delete recursively? (yes/no): " << RESET;
-                string confirm;
-                getline(cin, confirm);
+                if (!recursive && !interactive) {
+                    reportError() << "Directory is not empty (use recursive delete)!" << RESET << endl;
+                    return;
+                }
+                if (!recursive) {
+                    cout << YELLOW << "Directory is not empty. Delete recursively? (yes/no): " << RESET;
+                    string confirm;
+                    getline(cin, confirm);
+                    recursive = (confirm == "yes");
+                }
                 
-                if (confirm == "yes") {
+                if (recursive) {
                     if (deleteDirectoryRecursive(fullPath)) {
+                        indexNoteRemoved(fullPath);
                         cout << GREEN << "Directory and all contents deleted successfully: " << name << RESET << endl;
                     } else {
-                        cout << RED << "Error: Cannot delete directory!" << RESET << endl;
+                        reportError() << "Cannot delete directory!" << RESET << endl;
                     }
                 } else {
                     cout << YELLOW << "Operation cancelled." << RESET << endl;
@@ -263,92 +6368,50 @@ public:
             }
         } else {
             if (unlink(fullPath.c_str()) == 0) {
+                indexNoteRemoved(fullPath);
                 cout << GREEN << "File deleted successfully: " << name << RESET << endl;
             } else {
-                cout << RED << "Error: Cannot delete file!" << RESET << endl;
+                reportError() << "Cannot delete file!" << RESET << endl;
             }
         }
     }
     
     // Helper function to copy a single file
     bool copyFileInternal(const string& srcPath, const string& destPath) {
-        ifstream src(srcPath, ios::binary);
-        if (!src.is_open()) {
-            return false;
-        }
-        
-        ofstream dest(destPath, ios::binary);
-        if (!dest.is_open()) {
-            src.close();
+        int srcFd = open(srcPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (srcFd < 0) {
             return false;
         }
         
-        dest << src.rdbuf();
-        src.close();
-        dest.close();
-        
-        // Copy permissions from source to destination
-        struct stat srcStat;
-        if (stat(srcPath.c_str(), &srcStat) == 0) {
-            chmod(destPath.c_str(), srcStat.st_mode);
-        }
-        
-        return true;
-    }
-    
-    // Helper function to recursively copy directory
-    bool copyDirectoryRecursive(const string& srcPath, const string& destPath) {
         struct stat srcStat;
-        if (stat(srcPath.c_str(), &srcStat) != 0) {
-            return false;
-        }
-        
-        // Create destination directory
-        if (mkdir(destPath.c_str(), srcStat.st_mode) != 0) {
+        if (countedStat(srcFd, "", &srcStat, AT_EMPTY_PATH) != 0) {
+            close(srcFd);
             return false;
         }
         
-        DIR* dir = opendir(srcPath.c_str());
-        if (dir == NULL) {
+        int destFd = open(destPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (destFd < 0) {
+            close(srcFd);
             return false;
         }
         
-        struct dirent* entry;
-        bool success = true;
+        bool success = CopyEngine::copyContents(srcFd, destFd, srcStat);
         
-        while ((entry = readdir(dir)) != NULL) {
-            string filename = entry->d_name;
-            
-            // Skip . and ..
-            if (filename == "." || filename == "..") continue;
-            
-            string srcFullPath = srcPath + "/" + filename;
-            string destFullPath = destPath + "/" + filename;
-            
-            struct stat fileStat;
-            if (stat(srcFullPath.c_str(), &fileStat) == 0) {
-                if (S_ISDIR(fileStat.st_mode)) {
-                    // Recursively copy subdirectory
-                    if (!copyDirectoryRecursive(srcFullPath, destFullPath)) {
-                        success = false;
-                        break;
-                    }
-                } else {
-                    // Copy file
-                    if (!copyFileInternal(srcFullPath, destFullPath)) {
-                        success = false;
-                        break;
-                    }
-                }
-            }
+        // Copy permissions from source to destination
+        if (success) {
+            fchmod(destFd, srcStat.st_mode & 07777);
         }
         
-        closedir(dir);
+        close(srcFd);
+        if (close(destFd) != 0) {
+            success = false;
+        }
         return success;
     }
     
     // DAY 3: Copy file or directory
     void copyFile(const string& source, const string& destination) {
+        ScopedPhase timer(PHASE_COPY);
         string srcPath = currentPath + "/" + source;
         string destPath;
         
@@ -359,77 +6422,144 @@ public:
         }
         
         struct stat srcStat;
-        if (stat(srcPath.c_str(), &srcStat) != 0) {
-            cout << RED << "Error: Source does not exist!" << RESET << endl;
+        if (countedStat(AT_FDCWD, srcPath.c_str(), &srcStat, 0) != 0) {
+            reportError() << "Source does not exist!" << RESET << endl;
             return;
         }
         
         if (S_ISDIR(srcStat.st_mode)) {
             // Copy directory recursively
             cout << YELLOW << "Copying directory recursively..." << RESET << endl;
-            if (copyDirectoryRecursive(srcPath, destPath)) {
+            string destParent = destPath.substr(0, destPath.find_last_of('/') + 1);
+            ParallelTreeCopier copier(*getCopyPool(destParent.empty() ? "." : destParent));
+            CopyReport report = copier.copyTree(srcPath, destPath);
+            
+            if (report.directories == 0) {
+                reportError() << "Cannot copy directory!" << RESET << endl;
+                return;
+            }
+            indexNoteCreated(destPath, true);
+            
+            char rates[128];
+            double seconds = max(report.seconds, 1e-6);
+            snprintf(rates, sizeof(rates), "%zu files, %zu directories, %s in %.2f s (%.0f files/s, %.1f MB/s)",
+                     report.files, report.directories, formatFileSize(report.bytes).c_str(),
+                     report.seconds, report.files / seconds, report.bytes / seconds / (1024 * 1024));
+            
+            if (report.errors.empty()) {
                 cout << GREEN << "Directory copied successfully from " << source << " to " << destination << RESET << endl;
             } else {
-                cout << RED << "Error: Cannot copy directory!" << RESET << endl;
+                reportError() << report.errors.size() << " item(s) could not be copied:" << RESET << endl;
+                for (const auto& error : report.errors) {
+                    cout << RED << "  " << error.first << ": " << error.second << RESET << endl;
+                }
             }
+            cout << CYAN << rates << RESET << endl;
         } else {
             // Copy single file
             if (copyFileInternal(srcPath, destPath)) {
+                indexNoteCreated(destPath, false);
                 cout << GREEN << "File copied successfully from " << source << " to " << destination << RESET << endl;
             } else {
-                cout << RED << "Error: Cannot copy file!" << RESET << endl;
+                reportError() << "Cannot copy file!" << RESET << endl;
             }
         }
     }
     
-    // Helper function to recursively delete directory
-    bool deleteDirectoryRecursive(const string& path) {
-        DIR* dir = opendir(path.c_str());
-        if (dir == NULL) {
-            return false;
+    // Helper function to run (or resume) a pipelined cross-filesystem move
+    // with live progress; totals come from the disk usage scanner
+    void crossDeviceMove(const string& srcPath, const string& destPath, bool isDir) {
+        string destParent = destPath.substr(0, destPath.find_last_of('/') + 1);
+        WorkerPool* pool = getCopyPool(destParent.empty() ? "." : destParent);
+        
+        ResumableMover::Progress progress;
+        string journalSource;
+        if (ResumableMover::readJournal(ResumableMover::journalPathFor(destPath), journalSource,
+                                        progress.previousBytes, progress.previousFiles)) {
+            if (journalSource != srcPath) {
+                reportError() << destPath << " has an unfinished move from " << journalSource
+                     << "; finish it or remove " << ResumableMover::journalPathFor(destPath) << RESET << endl;
+                return;
+            }
+            cout << YELLOW << "Resuming: " << progress.previousFiles << " file(s), "
+                 << formatFileSize(progress.previousBytes) << " already moved" << RESET << endl;
         }
+        DiskUsageReport usage = diskUsageScanner.measure(canonicalPath(srcPath), pool);
+        progress.totalFiles = progress.previousFiles + usage.total.files;
+        progress.totalBytes = progress.previousBytes + usage.total.apparentBytes;
         
-        struct dirent* entry;
-        bool success = true;
+        ResumableMover mover(*pool);
+        CopyReport report = mover.move(srcPath, destPath, progress, isatty(STDOUT_FILENO) == 1);
         
-        while ((entry = readdir(dir)) != NULL) {
-            string filename = entry->d_name;
-            
-            // Skip . and ..
-            if (filename == "." || filename == "..") continue;
-            
-            string fullPath = path + "/" + filename;
-            struct stat fileStat;
-            
-            if (stat(fullPath.c_str(), &fileStat) == 0) {
-                if (S_ISDIR(fileStat.st_mode)) {
-                    // Recursively delete subdirectory
-                    if (!deleteDirectoryRecursive(fullPath)) {
-                        success = false;
-                        break;
-                    }
-                } else {
-                    // Delete file
-                    if (unlink(fullPath.c_str()) != 0) {
-                        success = false;
-                        break;
-                    }
-                }
+        if (report.errors.empty()) {
+            indexNoteCreated(destPath, isDir);
+            indexNoteRemoved(srcPath);
+            cout << GREEN << (isDir ? "Directory" : "File") << " moved successfully to " << destPath << RESET << endl;
+        } else {
+            if (isDir && report.directories > 0) indexNoteCreated(destPath, true);
+            reportError() << report.errors.size() << " item(s) could not be moved:" << RESET << endl;
+            for (size_t i = 0; i < report.errors.size() && i < 20; i++) {
+                cout << RED << "  " << report.errors[i].first << ": " << report.errors[i].second << RESET << endl;
             }
+            cout << YELLOW << "Run the same move again to resume; progress is kept in "
+                 << ResumableMover::journalPathFor(destPath) << RESET << endl;
         }
         
-        closedir(dir);
-        
-        // Finally, delete the directory itself
-        if (success && rmdir(path.c_str()) != 0) {
-            success = false;
+        char rates[160];
+        double seconds = max(report.seconds, 1e-6);
+        snprintf(rates, sizeof(rates), "%zu files, %s in %.2f s (%.0f files/s, %.1f MB/s)",
+                 report.files, formatFileSize(report.bytes).c_str(), report.seconds,
+                 report.files / seconds, report.bytes / seconds / (1024 * 1024));
+        cout << CYAN << rates << RESET << endl;
+    }
+    
+    // Helper function to resume an interrupted move of srcPath to destPath;
+    // false when no journal for that pair exists
+    bool resumeMove(const string& srcPath, const string& destPath) {
+        string journalSource;
+        unsigned long long bytes = 0;
+        size_t files = 0;
+        if (!ResumableMover::readJournal(ResumableMover::journalPathFor(destPath), journalSource, bytes, files)
+            || journalSource != srcPath) {
+            return false;
+        }
+        struct stat srcStat;
+        if (countedStat(AT_FDCWD, srcPath.c_str(), &srcStat, AT_SYMLINK_NOFOLLOW) != 0) {
+            return false;
+        }
+        cout << YELLOW << "Found an interrupted move to " << destPath << RESET << endl;
+        crossDeviceMove(srcPath, destPath, S_ISDIR(srcStat.st_mode));
+        return true;
+    }
+    
+    // Helper function to recursively delete directory
+    bool deleteDirectoryRecursive(const string& path) {
+        ScopedPhase timer(PHASE_DELETE);
+        // Work relative to the parent directory's fd
+        string trimmed = path;
+        while (trimmed.size() > 1 && trimmed[trimmed.size() - 1] == '/') {
+            trimmed.erase(trimmed.size() - 1);
+        }
+        size_t slash = trimmed.find_last_of('/');
+        string parent = (slash == string::npos) ? "." : (slash == 0 ? "/" : trimmed.substr(0, slash));
+        string name = (slash == string::npos) ? trimmed : trimmed.substr(slash + 1);
+        if (name.empty() || name == "." || name == "..") {
+            return false;
         }
         
+        int parentFd = open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (parentFd < 0) {
+            return false;
+        }
+        TreeRemover remover(metadataThreads > 1 ? getWorkerPool() : NULL);
+        bool success = remover.remove(parentFd, name);
+        close(parentFd);
         return success;
     }
     
     // DAY 3: Move file or directory (to different location)
     void moveFile(const string& source, const string& destination) {
+        ScopedPhase timer(PHASE_MOVE);
         string srcPath = currentPath + "/" + source;
         string destPath;
         
@@ -441,14 +6571,20 @@ public:
         }
         
         struct stat srcStat;
-        if (stat(srcPath.c_str(), &srcStat) != 0) {
-            cout << RED << "Error: Source does not exist!" << RESET << endl;
+        if (countedStat(AT_FDCWD, srcPath.c_str(), &srcStat, 0) != 0) {
+            reportError() << "Source does not exist!" << RESET << endl;
+            return;
+        }
+        
+        // An interrupted cross-filesystem move of this source is resumed
+        // rather than refused because its destination exists
+        if (resumeMove(srcPath, destPath)) {
             return;
         }
         
         // Check if destination exists and is a directory
         struct stat destStat;
-        if (stat(destPath.c_str(), &destStat) == 0) {
+        if (countedStat(AT_FDCWD, destPath.c_str(), &destStat, 0) == 0) {
             if (S_ISDIR(destStat.st_mode)) {
                 // Destination is a directory, move source INSIDE it
                 string sourceName = source;
@@ -457,53 +6593,38 @@ public:
                     sourceName = source.substr(lastSlash + 1);
                 }
                 destPath = destPath + "/" + sourceName;
+                if (resumeMove(srcPath, destPath)) {
+                    return;
+                }
                 
                 // Check if this new path already exists
-                if (stat(destPath.c_str(), &destStat) == 0) {
-                    cout << RED << "Error: '" << sourceName << "' already exists in destination directory!" << RESET << endl;
+                if (countedStat(AT_FDCWD, destPath.c_str(), &destStat, 0) == 0) {
+                    reportError() << "'" << sourceName << "' already exists in destination directory!" << RESET << endl;
                     return;
                 }
             } else {
                 // Destination is a file
-                cout << RED << "Error: Destination already exists as a file!" << RESET << endl;
+                reportError() << "Destination already exists as a file!" << RESET << endl;
                 return;
             }
         }
         
         // Try simple rename first (works if same filesystem)
         if (rename(srcPath.c_str(), destPath.c_str()) == 0) {
+            indexNoteRemoved(srcPath);
+            indexNoteCreated(destPath, S_ISDIR(srcStat.st_mode));
             if (S_ISDIR(srcStat.st_mode)) {
                 cout << GREEN << "Directory moved successfully to " << destPath << RESET << endl;
             } else {
                 cout << GREEN << "File moved successfully to " << destPath << RESET << endl;
             }
+        } else if (errno == EXDEV) {
+            // Cross-filesystem: copy, verify and delete file by file
+            cout << YELLOW << "Cross-filesystem move detected, moving file by file..." << RESET << endl;
+            crossDeviceMove(srcPath, destPath, S_ISDIR(srcStat.st_mode));
         } else {
-            // If rename fails (cross-filesystem), do copy + delete
-            cout << YELLOW << "Cross-filesystem move detected, copying and deleting original..." << RESET << endl;
-            
-            if (S_ISDIR(srcStat.st_mode)) {
-                // Copy directory then delete
-                if (copyDirectoryRecursive(srcPath, destPath)) {
-                    if (deleteDirectoryRecursive(srcPath)) {
-                        cout << GREEN << "Directory moved successfully to " << destPath << RESET << endl;
-                    } else {
-                        cout << RED << "Error: Copied but could not delete source directory!" << RESET << endl;
-                    }
-                } else {
-                    cout << RED << "Error: Cannot move directory!" << RESET << endl;
-                }
-            } else {
-                // Copy file then delete
-                if (copyFileInternal(srcPath, destPath)) {
-                    if (unlink(srcPath.c_str()) == 0) {
-                        cout << GREEN << "File moved successfully to " << destPath << RESET << endl;
-                    } else {
-                        cout << RED << "Error: Copied but could not delete source file!" << RESET << endl;
-                    }
-                } else {
-                    cout << RED << "Error: Cannot move file!" << RESET << endl;
-                }
-            }
+            reportError() << "Cannot move " << (S_ISDIR(srcStat.st_mode) ? "directory" : "file")
+                 << ": " << strerror(errno) << RESET << endl;
         }
     }
     
@@ -513,41 +6634,683 @@ public:
         string newPath = currentPath + "/" + newName;
         
         struct stat srcStat;
-        if (stat(oldPath.c_str(), &srcStat) != 0) {
-            cout << RED << "Error: Item does not exist!" << RESET << endl;
+        if (countedStat(AT_FDCWD, oldPath.c_str(), &srcStat, 0) != 0) {
+            reportError() << "Item does not exist!" << RESET << endl;
             return;
         }
         
         // Check if new name already exists
         struct stat destStat;
-        if (stat(newPath.c_str(), &destStat) == 0) {
-            cout << RED << "Error: An item with name '" << newName << "' already exists!" << RESET << endl;
+        if (countedStat(AT_FDCWD, newPath.c_str(), &destStat, 0) == 0) {
+            reportError() << "An item with name '" << newName << "' already exists!" << RESET << endl;
             return;
         }
         
         if (rename(oldPath.c_str(), newPath.c_str()) == 0) {
+            indexNoteRemoved(oldPath);
+            indexNoteCreated(newPath, S_ISDIR(srcStat.st_mode));
             if (S_ISDIR(srcStat.st_mode)) {
                 cout << GREEN << "Directory renamed from '" << oldName << "' to '" << newName << "'" << RESET << endl;
             } else {
                 cout << GREEN << "File renamed from '" << oldName << "' to '" << newName << "'" << RESET << endl;
             }
         } else {
-            cout << RED << "Error: Cannot rename item!" << RESET << endl;
+            reportError() << "Cannot rename item!" << RESET << endl;
+        }
+    }
+    
+    // Apply one operation to many names in the current directory.
+    //   operation: create | mkdir | delete | rename | chmod | chown
+    //              (create and mkdir never touch an existing name; such
+    //              items fail with EEXIST)
+    //   selector : "@file" (one name per line), a glob matched against the
+    //              current directory (case-sensitive, like the shell), or
+    //              space-separated names
+    //   argument : rename - new name with "{}" standing for the old name,
+    //              an existing directory to move into, or (for a single
+    //              item) just the new name; chmod - octal
+    //              mode; chown - user[:group]; delete - "-r" to remove
+    //              non-empty directories too
+    void batchOperation(const string& operation, const string& selector, const string& argument = "") {
+        BatchOperation op;
+        if (operation == "create") op = BATCH_CREATE;
+        else if (operation == "mkdir") op = BATCH_MKDIR;
+        else if (operation == "delete") op = BATCH_DELETE;
+        else if (operation == "rename") op = BATCH_RENAME;
+        else if (operation == "chmod") op = BATCH_CHMOD;
+        else if (operation == "chown") op = BATCH_CHOWN;
+        else {
+            reportError() << "Unknown batch operation '" << operation << "'!" << RESET << endl;
+            return;
+        }
+        
+        int dirFd = open(currentPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            reportError() << "Cannot open directory!" << RESET << endl;
+            return;
+        }
+        WorkerPool* pool = metadataThreads > 1 ? getWorkerPool() : NULL;
+        BatchRunner runner(dirFd, pool);
+        
+        vector<BatchItem> items;
+        string error;
+        if (!selectBatchItems(dirFd, selector, items, error)
+            || !configureBatch(op, argument, runner, items, error)) {
+            reportError() << error << RESET << endl;
+            close(dirFd);
+            return;
+        }
+        if (items.empty()) {
+            reportError() << "No items selected by: " << selector << RESET << endl;
+            close(dirFd);
+            return;
+        }
+        
+        BatchReport report = runner.run(op, items);
+        close(dirFd);
+        
+        // Failures are listed per item; successes go to the name index
+        OutputBuffer out;
+        for (const auto& item : items) {
+            string fullPath = currentPath + "/" + item.name;
+            if (item.error != 0) {
+                out.color(RED).append("  ").append(item.name).append(": ")
+                   .append(item.error == BatchItem::OUTCOME_UNKNOWN ? "Outcome unknown (io_uring submission failed)"
+                                                                  : strerror(item.error))
+                   .color(RESET).append('\n');
+                continue;
+            }
+            switch (op) {
+            case BATCH_CREATE:
+                indexNoteCreated(fullPath, false);
+                break;
+            case BATCH_MKDIR:
+                indexNoteCreated(fullPath, true);
+                break;
+            case BATCH_DELETE:
+                indexNoteRemoved(fullPath);
+                break;
+            case BATCH_RENAME:
+                if (nameIndex) {
+                    string newPath = item.target[0] == '/' ? item.target : currentPath + "/" + item.target;
+                    struct stat newStat;
+                    indexNoteRemoved(fullPath);
+                    indexNoteCreated(newPath, countedStat(AT_FDCWD, newPath.c_str(), &newStat, 0) == 0
+                                              && S_ISDIR(newStat.st_mode));
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        out.flush();
+        
+        char summary[160];
+        double seconds = max(report.seconds, 1e-6);
+        snprintf(summary, sizeof(summary), "%s: %zu succeeded, %zu failed in %.3f s (%.0f ops/s, %s)",
+                 operation.c_str(), report.succeeded, report.failed, report.seconds,
+                 items.size() / seconds, report.engine);
+        // Any failed item fails the command, so scripts can stop on it
+        if (report.failed == 0) {
+            cout << GREEN << summary << RESET << endl;
+        } else {
+            reportError() << summary << RESET << endl;
+        }
+    }
+    
+    // Build (or rebuild) the name index used by searchFiles for 'root'
+    void rebuildIndex(const string& root = "") {
+        string rootPath = canonicalPath(root.empty() ? currentPath : root);
+        cout << YELLOW << "Indexing " << rootPath << "..." << RESET << endl;
+        
+        auto start = chrono::steady_clock::now();
+        uint64_t entryCount = 0;
+        string error;
+        if (!NameIndex::build(rootPath, entryCount, error)) {
+            reportError() << "Cannot build index: " << error << RESET << endl;
+            return;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        indexWatcher.reset();
+        nameIndex.reset();
+        
+        char summary[128];
+        snprintf(summary, sizeof(summary), "Indexed %llu entries in %.2f s",
+                 static_cast<unsigned long long>(entryCount), seconds);
+        cout << GREEN << summary << RESET << endl;
+    }
+    
+    // Run a name search against both the index and a live crawl and report
+    // timings and any differences
+    void compareIndexWithCrawl(const string& searchTerm, const string& searchPath = "") {
+        string basePath = searchPath.empty() ? currentPath : searchPath;
+        vector<string> indexed, crawled;
+        
+        auto start = chrono::steady_clock::now();
+        if (!searchNameIndex(basePath, searchTerm, indexed)) {
+            reportError() << "No index covers " << basePath << RESET << endl;
+            return;
+        }
+        auto middle = chrono::steady_clock::now();
+        crawlNames(basePath, NameMatcher::fromSearchTerm(searchTerm), crawled);
+        auto end = chrono::steady_clock::now();
+        
+        sort(indexed.begin(), indexed.end());
+        sort(crawled.begin(), crawled.end());
+        vector<string> missing, extra;
+        set_difference(crawled.begin(), crawled.end(), indexed.begin(), indexed.end(), back_inserter(missing));
+        set_difference(indexed.begin(), indexed.end(), crawled.begin(), crawled.end(), back_inserter(extra));
+        
+        char timing[160];
+        snprintf(timing, sizeof(timing), "Index: %zu matches in %.1f ms | Crawl: %zu matches in %.1f ms",
+                 indexed.size(), chrono::duration<double, milli>(middle - start).count(),
+                 crawled.size(), chrono::duration<double, milli>(end - middle).count());
+        cout << CYAN << timing << RESET << endl;
+        
+        for (const auto& path : missing) {
+            cout << YELLOW << "  not in index: " << path << RESET << endl;
+        }
+        for (const auto& path : extra) {
+            cout << YELLOW << "  only in index: " << path << RESET << endl;
+        }
+        if (missing.empty() && extra.empty()) {
+            cout << GREEN << "Index and crawl agree." << RESET << endl;
+        }
+    }
+    
+    // Disk usage of 'path' (default: the current directory) with its largest
+    // subdirectories. Directories unchanged since an earlier call in this
+    // session are taken from the cache instead of being read again.
+    void diskUsage(const string& path = "", size_t top = 10) {
+        string target = path.empty() ? currentPath : (path[0] == '/' ? path : currentPath + "/" + path);
+        target = canonicalPath(target);
+        
+        struct stat targetStat;
+        if (countedStat(AT_FDCWD, target.c_str(), &targetStat, AT_SYMLINK_NOFOLLOW) != 0) {
+            reportError() << "Path does not exist!" << RESET << endl;
+            return;
+        }
+        
+        DiskUsageReport report;
+        {
+            ScopedPhase timer(PHASE_DISK_USAGE);
+            report = diskUsageScanner.measure(target, getWorkerPool());
+        }
+        
+        cout << BOLD << CYAN << "Disk usage of " << target << RESET << endl;
+        cout << "  Apparent size : " << formatFileSize(report.total.apparentBytes) << endl;
+        cout << "  Allocated     : " << formatFileSize(report.total.allocatedBytes) << endl;
+        cout << "  Files         : " << report.total.files << endl;
+        cout << "  Directories   : " << report.total.directories << endl;
+        if (report.hardLinksSkipped > 0) {
+            cout << "  Hard links    : " << report.hardLinksSkipped << " extra link(s) counted once" << endl;
+        }
+        
+        // Largest subdirectories by allocated size
+        vector<pair<string, DiskUsageTotals>>& children = report.children;
+        size_t shown = min(top, children.size());
+        partial_sort(children.begin(), children.begin() + shown, children.end(),
+                     [](const pair<string, DiskUsageTotals>& a, const pair<string, DiskUsageTotals>& b) {
+                         return a.second.allocatedBytes > b.second.allocatedBytes;
+                     });
+        if (shown > 0) {
+            cout << "\n" << GREEN << "Largest subdirectories:" << RESET << endl;
+            for (size_t i = 0; i < shown; i++) {
+                cout << "  " << left << setw(12) << formatFileSize(children[i].second.allocatedBytes)
+                     << BLUE << BOLD << children[i].first << "/" << RESET << endl;
+            }
+        }
+        
+        if (!report.errors.empty()) {
+            reportError() << report.errors.size() << " item(s) could not be read:" << RESET << endl;
+            for (size_t i = 0; i < report.errors.size() && i < 10; i++) {
+                cout << RED << "  " << report.errors[i].first << ": " << report.errors[i].second << RESET << endl;
+            }
+        }
+        
+        char timing[128];
+        snprintf(timing, sizeof(timing), "%zu directories read, %zu from cache, in %.2f s",
+                 report.scannedDirectories, report.cachedDirectories, report.seconds);
+        cout << CYAN << timing << RESET << endl;
+    }
+    
+    // Search file contents below basePath, streaming "path:line: text"
+    // rows in walk order as the workers finish
+    void searchContents(const string& pattern, const string& basePath, bool isRegex) {
+        if (pattern.empty()) {
+            reportError() << "Search pattern cannot be empty!" << RESET << endl;
+            return;
+        }
+        ScopedPhase timer(PHASE_SEARCH);
+        unique_ptr<ContentSearcher> searcher;
+        try {
+            searcher.reset(new ContentSearcher(*getWorkerPool(), pattern, isRegex));
+        } catch (const regex_error& error) {
+            reportError() << "Invalid regular expression: " << error.what() << RESET << endl;
+            return;
+        }
+        
+        cout << GREEN << "\nContent matches for '" << pattern << "':" << RESET << endl;
+        cout << string(80, '-') << endl;
+        
+        size_t matchCount = 0, fileCount = 0;
+        OutputBuffer out;
+        ContentSearcher::Stats stats = searcher->run(basePath,
+            [&](const string& path, const vector<ContentMatch>& matches) {
+                fileCount++;
+                for (const auto& match : matches) {
+                    out.color(MAGENTA).append(path).color(RESET).append(':')
+                       .color(GREEN).appendNumber(match.line).color(RESET)
+                       .append(": ").append(match.text).append('\n');
+                }
+                matchCount += matches.size();
+                // Stream: each file's rows go out as soon as its turn comes
+                out.flush();
+            });
+        
+        cout << "\nTotal matches: " << matchCount << " in " << fileCount << " file(s)" << endl;
+        cout << CYAN << "Scanned " << stats.filesScanned << " files (" << formatFileSize(stats.bytesRead)
+             << "), skipped " << stats.binarySkipped << " binary, " << stats.truncated
+             << " cut at the " << formatFileSize(ContentSearcher::DEFAULT_BYTE_BUDGET) << " limit, "
+             << stats.unreadable << " unreadable" << RESET << endl;
+        if (stats.longLines > 0) {
+            cout << YELLOW << stats.longLines << " line(s) longer than " << ContentSearcher::MAX_REGEX_LINE
+                 << " bytes were only matched on their start" << RESET << endl;
+        }
+    }
+    
+    // Helper function to split a script line into words. Single and double
+    // quotes group words, a backslash escapes the next character and an
+    // unquoted '#' starts a comment.
+    static bool splitCommandLine(const string& line, vector<string>& words, string& error) {
+        words.clear();
+        string word;
+        bool inWord = false;
+        char quote = 0;
+        for (size_t i = 0; i < line.size(); i++) {
+            char c = line[i];
+            if (quote != 0) {
+                if (c == quote) {
+                    quote = 0;
+                } else if (c == '\\' && quote == '"' && i + 1 < line.size()) {
+                    word += line[++i];
+                } else {
+                    word += c;
+                }
+            } else if (c == '\'' || c == '"') {
+                quote = c;
+                inWord = true;
+            } else if (c == '\\' && i + 1 < line.size()) {
+                word += line[++i];
+                inWord = true;
+            } else if (isspace(static_cast<unsigned char>(c))) {
+                if (inWord) words.push_back(word);
+                word.clear();
+                inWord = false;
+            } else if (c == '#' && !inWord) {
+                break;
+            } else {
+                word += c;
+                inWord = true;
+            }
+        }
+        if (quote != 0) {
+            error = "Unterminated quote";
+            return false;
+        }
+        if (inWord) words.push_back(word);
+        return true;
+    }
+    
+    // Helper function to join words[first..] back into one argument
+    static string joinWords(const vector<string>& words, size_t first) {
+        string joined;
+        for (size_t i = first; i < words.size(); i++) {
+            if (i > first) joined += ' ';
+            joined += words[i];
+        }
+        return joined;
+    }
+    
+    // Runs one scripted command. Returns false only for an unknown command
+    // or wrong usage; failures of the operation itself are reported by the
+    // operation, as in the menu.
+    bool runCommand(const vector<string>& words) {
+        const string& command = words[0];
+        size_t argc = words.size() - 1;
+        bool longFlag = argc >= 1 && words[1] == "-l";
+        
+        if (command == "ls") {
+            size_t first = longFlag ? 2 : 1;
+            if (first < words.size()) {
+                listFilesWhere(joinWords(words, first), longFlag);
+            } else {
+                listFiles(longFlag);
+            }
+        } else if (command == "page") {
+            bool unsorted = find(words.begin() + 1, words.end(), "-u") != words.end();
+            bool detailed = find(words.begin() + 1, words.end(), "-l") != words.end();
+            listFilesPaged(detailed, !unsorted);
+        } else if (command == "next" && argc == 0) {
+            nextPage();
+        } else if (command == "prev" && argc == 0) {
+            prevPage();
+        } else if (command == "pagesize" && argc == 1) {
+            setPageSize(strtoul(words[1].c_str(), NULL, 10));
+        } else if (command == "cd" && argc == 1) {
+            changeDirectory(words[1]);
+        } else if (command == "pwd" && argc == 0) {
+            cout << currentPath << endl;
+        } else if (command == "touch" && argc == 1) {
+            createFile(words[1]);
+        } else if (command == "mkdir" && argc == 1) {
+            createDirectory(words[1]);
+        } else if (command == "rm" && argc == 1) {
+            deleteItem(words[1]);
+        } else if (command == "rm" && argc == 2 && words[1] == "-r") {
+            deleteItem(words[2], true);
+        } else if (command == "cp" && argc == 2) {
+            copyFile(words[1], words[2]);
+        } else if (command == "mv" && argc == 2) {
+            moveFile(words[1], words[2]);
+        } else if (command == "rename" && argc == 2) {
+            renameItem(words[1], words[2]);
+        } else if ((command == "find" || command == "grep" || command == "egrep") && (argc == 1 || argc == 2)) {
+            SearchMode mode = command == "find" ? SEARCH_NAMES
+                            : (command == "grep" ? SEARCH_CONTENTS : SEARCH_CONTENTS_REGEX);
+            searchFiles(words[1], argc == 2 ? words[2] : "", mode);
+        } else if (command == "du" && argc <= 2) {
+            diskUsage(argc >= 1 ? words[1] : "", argc == 2 ? strtoul(words[2].c_str(), NULL, 10) : 10);
+        } else if (command == "batch" && (argc == 2 || argc == 3)) {
+            batchOperation(words[1], words[2], argc == 3 ? words[3] : "");
+        } else if (command == "dups" && argc <= 2) {
+            string path, action;
+            for (size_t i = 1; i < words.size(); i++) {
+                if (words[i] == "hardlink" || words[i] == "reflink") action = words[i];
+                else path = words[i];
+            }
+            findDuplicates(path, action);
+        } else if (command == "index" && argc <= 1) {
+            rebuildIndex(argc == 1 ? words[1] : "");
+        } else if (command == "index-check" && (argc == 1 || argc == 2)) {
+            compareIndexWithCrawl(words[1], argc == 2 ? words[2] : "");
+        } else if (command == "threads" && argc == 1) {
+            setMetadataThreads(static_cast<unsigned>(strtoul(words[1].c_str(), NULL, 10)));
+        } else if (command == "stats" && argc <= 1) {
+            string action = argc == 1 ? words[1] : "show";
+            if (action == "on") setStatsEnabled(true);
+            else if (action == "off") setStatsEnabled(false);
+            else if (action == "reset") resetStats();
+            else if (action == "show") showStats();
+            else if (action == "names") showNameCacheStats();
+            else if (action == "snapshots") showSnapshotCacheStats();
+            else return false;
+        } else if (command == "trace" && argc == 1) {
+            if (words[1] == "stop") stopStatsTrace();
+            else startStatsTrace(words[1]);
+        } else if (command == "echo") {
+            cout << joinWords(words, 1) << endl;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    
+    // Scripted mode: runs one command per line from 'input' on this
+    // explorer, so caches, the name index and the thread pools stay warm
+    // across commands. A command fails when it is unknown or reports an
+    // error. Output is passed through as it is written; with 'ndjson' it is
+    // streamed as chunk objects instead and every command ends with one
+    // status object:
+    //   {"line":3,"output":"..."}                       (zero or more)
+    //   {"line":3,"command":"ls -l","ok":true,"ms":1.2}
+    // followed by a summary object. Returns the number of failed commands.
+    size_t runScript(istream& input, bool ndjson, bool stopOnError = false) {
+        bool wasInteractive = interactive;
+        interactive = false;
+        
+        size_t lineNumber = 0, commands = 0, failures = 0;
+        OutputCapture capture([&](const string& chunk) {
+            string record = "{\"line\":" + to_string(lineNumber) + ",\"output\":";
+            appendJsonString(record, stripColors(chunk));
+            record += "}\n";
+            capture.forward(record);
+        });
+        auto start = chrono::steady_clock::now();
+        string line, record;
+        vector<string> words;
+        while (getline(input, line)) {
+            lineNumber++;
+            string error;
+            if (!splitCommandLine(line, words, error)) {
+                words.assign(1, line);
+            } else if (words.empty()) {
+                continue;
+            }
+            commands++;
+            
+            auto commandStart = chrono::steady_clock::now();
+            size_t errorsBefore = errorCount;
+            bool captured = ndjson && capture.begin();
+            if (!error.empty()) {
+                reportError() << error << RESET << endl;
+            } else if (!runCommand(words)) {
+                reportError() << "Unknown command or wrong arguments: " << line << RESET << endl;
+            }
+            cout.flush();
+            if (captured) capture.end();
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - commandStart).count();
+            
+            bool ok = errorCount == errorsBefore;
+            if (!ok) failures++;
+            
+            if (ndjson) {
+                char number[32];
+                record = "{\"line\":";
+                record += to_string(lineNumber);
+                record += ",\"command\":";
+                appendJsonString(record, line);
+                record += ok ? ",\"ok\":true,\"ms\":" : ",\"ok\":false,\"ms\":";
+                snprintf(number, sizeof(number), "%.3f", ms);
+                record += number;
+                record += "}\n";
+                OutputBuffer out;
+                out.append(record);
+            }
+            
+            if (!ok && stopOnError) break;
+        }
+        
+        if (ndjson) {
+            char summary[160];
+            snprintf(summary, sizeof(summary),
+                     "{\"summary\":true,\"commands\":%zu,\"failed\":%zu,\"seconds\":%.3f}\n", commands, failures,
+                     chrono::duration<double>(chrono::steady_clock::now() - start).count());
+            OutputBuffer out;
+            out.append(summary);
+        }
+        interactive = wasInteractive;
+        return failures;
+    }
+    
+    // Command-line entry point for automation; main() is expected to hand
+    // over to it when the program is started with arguments
+    // ("if (argc > 1) return FileExplorer::runBatchMode(argc, argv);"):
+    //   file_explorer [--ndjson] [--stop-on-error] [-C dir] -c "ls -l" -c "du"
+    //   file_explorer [--ndjson] [--stop-on-error] [-C dir] [--script file|-]
+    // Without -c the commands are read from the script file or stdin.
+    // Exit status: 0 all commands succeeded, 1 some failed, 2 bad usage.
+    static int runBatchMode(int argc, char* argv[]) {
+        bool ndjson = false, stopOnError = false;
+        string directory, scriptPath;
+        string commands;
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--ndjson") {
+                ndjson = true;
+            } else if (arg == "--stop-on-error") {
+                stopOnError = true;
+            } else if ((arg == "-C" || arg == "-c" || arg == "--script") && i + 1 < argc) {
+                string value = argv[++i];
+                if (arg == "-C") directory = value;
+                else if (arg == "-c") commands += value + "\n";
+                else scriptPath = value;
+            } else {
+                cerr << "Usage: " << argv[0] << " [--ndjson] [--stop-on-error] [-C dir]"
+                     << " [-c command]... [--script file|-]" << endl;
+                return 2;
+            }
+        }
+        
+        FileExplorer explorer;
+        if (!directory.empty()) {
+            // Quietly: only the script's own output goes to stdout
+            OutputCapture discard([](const string&) {});
+            bool captured = discard.begin();
+            explorer.changeDirectory(directory);
+            if (captured) discard.end();
+            if (explorer.errorCount != 0) {
+                cerr << "Error: Cannot change to " << directory << endl;
+                return 2;
+            }
+        }
+        
+        size_t failures;
+        if (!commands.empty()) {
+            istringstream input(commands);
+            failures = explorer.runScript(input, ndjson, stopOnError);
+        } else if (!scriptPath.empty() && scriptPath != "-") {
+            ifstream input(scriptPath.c_str());
+            if (!input) {
+                cerr << "Error: Cannot read script " << scriptPath << endl;
+                return 2;
+            }
+            failures = explorer.runScript(input, ndjson, stopOnError);
+        } else {
+            failures = explorer.runScript(cin, ndjson, stopOnError);
+        }
+        return failures == 0 ? 0 : 1;
+    }
+    
+    // DAY 4: Duplicate finder - lists sets of identical files below 'path'
+    // (default: the current directory) with the space they waste. With
+    // 'action' "hardlink" or "reflink" every duplicate is replaced by a hard
+    // link to, or a reflinked copy of, the first file of its set.
+    void findDuplicates(const string& path = "", const string& action = "", size_t top = 20) {
+        DuplicateFinder::LinkMode mode = DuplicateFinder::LINK_HARD;
+        if (action == "reflink") {
+            mode = DuplicateFinder::LINK_REFLINK;
+        } else if (!action.empty() && action != "hardlink") {
+            reportError() << "Unknown action '" << action << "' (use hardlink or reflink)!" << RESET << endl;
+            return;
+        }
+        string target = path.empty() ? currentPath : (path[0] == '/' ? path : currentPath + "/" + path);
+        target = canonicalPath(target);
+        
+        struct stat targetStat;
+        if (countedStat(AT_FDCWD, target.c_str(), &targetStat, 0) != 0 || !S_ISDIR(targetStat.st_mode)) {
+            reportError() << "Directory does not exist!" << RESET << endl;
+            return;
+        }
+        
+        DuplicateFinder finder(getWorkerPool());
+        DuplicateReport report = finder.find(target);
+        
+        if (report.sets.empty()) {
+            cout << YELLOW << "No duplicate files found in: " << target << RESET << endl;
+        } else {
+            cout << GREEN << "\nDuplicate files in " << target << ":" << RESET << endl;
+            cout << string(80, '-') << endl;
+            OutputBuffer out;
+            size_t shown = min(top, report.sets.size());
+            for (size_t i = 0; i < shown; i++) {
+                const DuplicateSet& set = report.sets[i];
+                out.color(BOLD).appendNumber(set.paths.size()).append(" x ").append(formatFileSize(set.size))
+                   .append(", ").append(formatFileSize(set.reclaimableBytes())).append(" reclaimable")
+                   .color(RESET).append('\n');
+                for (const auto& duplicate : set.paths) {
+                    out.append("  ").append(duplicate).append('\n');
+                }
+            }
+            if (shown < report.sets.size()) {
+                out.append("... and ").appendNumber(report.sets.size() - shown).append(" more set(s)\n");
+            }
+        }
+        
+        char summary[256];
+        snprintf(summary, sizeof(summary),
+                 "%zu set(s), %s reclaimable. %zu files scanned, %zu same size, %zu same first/last blocks, "
+                 "%s hashed in %.2f s",
+                 report.sets.size(), formatFileSize(report.reclaimableBytes()).c_str(), report.filesScanned,
+                 report.sizeCandidates, report.edgeCandidates, formatFileSize(report.bytesHashed).c_str(),
+                 report.seconds);
+        cout << "\n" << CYAN << summary << RESET << endl;
+        if (report.hardLinksSkipped > 0) {
+            cout << CYAN << report.hardLinksSkipped << " name(s) already hard-linked to a scanned file" << RESET << endl;
+        }
+        
+        vector<pair<string, string>>& errors = report.errors;
+        if (!action.empty() && !report.sets.empty()) {
+            if (interactive) {
+                cout << YELLOW << "Replace duplicates with " << (mode == DuplicateFinder::LINK_HARD ? "hard links" : "reflinks")
+                     << "? (yes/no): " << RESET;
+                string confirm;
+                getline(cin, confirm);
+                if (confirm != "yes") {
+                    cout << YELLOW << "Operation cancelled." << RESET << endl;
+                    return;
+                }
+            }
+            size_t replaced = 0;
+            unsigned long long reclaimed = 0;
+            for (const auto& set : report.sets) {
+                size_t count = DuplicateFinder::replaceWithLinks(set, mode, errors);
+                replaced += count;
+                reclaimed += count * set.size;
+            }
+            cout << GREEN << "Replaced " << replaced << " file(s), " << formatFileSize(reclaimed)
+                 << (mode == DuplicateFinder::LINK_HARD ? " freed" : " now shared") << RESET << endl;
+        }
+        
+        if (!errors.empty()) {
+            reportError() << errors.size() << " item(s) could not be processed:" << RESET << endl;
+            for (size_t i = 0; i < errors.size() && i < 10; i++) {
+                cout << RED << "  " << errors[i].first << ": " << errors[i].second << RESET << endl;
+            }
         }
     }
     
     // DAY 4: Search functionality
-    void searchFiles(const string& searchTerm, const string& searchPath = "") {
+    void searchFiles(const string& searchTerm, const string& searchPath = "", SearchMode mode = SEARCH_NAMES) {
+        if (searchTerm.empty()) {
+            reportError() << "Search term cannot be empty!" << RESET << endl;
+            return;
+        }
         string basePath = searchPath.empty() ? currentPath : searchPath;
+        if (mode != SEARCH_NAMES) {
+            searchContents(searchTerm, basePath, mode == SEARCH_CONTENTS_REGEX);
+            return;
+        }
         vector<string> results;
-        searchRecursive(basePath, searchTerm, results);
+        
+        // Answer from the name index when one covers this path. Terms may
+        // be globs ("*.log", "glob:file?.c"), anchored ("^core", "tmp$") or
+        // taken literally ("lit:^a[1]").
+        {
+            ScopedPhase timer(PHASE_SEARCH);
+            if (!searchNameIndex(basePath, searchTerm, results)) {
+                crawlNames(basePath, NameMatcher::fromSearchTerm(searchTerm), results);
+            }
+        }
         
         if (results.empty()) {
             cout << YELLOW << "No files found matching: " << searchTerm << RESET << endl;
         } else {
             cout << GREEN << "\nSearch results for '" << searchTerm << "':" << RESET << endl;
             cout << string(80, '-') << endl;
+            OutputBuffer out;
             for (const auto& result : results) {
-                cout << result << endl;
+                out.append(result).append('\n');
             }
+            out.flush();
             cout << "\nTotal matches: " << results.size() <<
@@ -0,0 +1,575 @@
+// Benchmarks for the File Explorer application
+//
+// The explorer is a single translation unit, so it is pulled in here with
+// its main() renamed out of the way.
+#define main file_explorer_main
+#include "fileexplorer.cpp"
+#undef main
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+// Helper function to create 'count' empty files named f0..fN-1 in 'dir'
+static bool generateFlatDirectory(const string& dir, size_t count) {
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        return false;
+    }
+    int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
+        return false;
+    }
+    char name[32];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "f%zu", i);
+        int fd = openat(dirFd, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            close(dirFd);
+            return false;
+        }
+        close(fd);
+    }
+    close(dirFd);
+    return true;
+}
+
+// Helper class that sends stdout to /dev/null while an operation runs, so
+// its own printing does not end up in the timings
+class StdoutSilencer {
+private:
+    int savedFd;
+
+public:
+    StdoutSilencer() {
+        cout.flush();
+        savedFd = dup(STDOUT_FILENO);
+        int nullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (nullFd >= 0) {
+            dup2(nullFd, STDOUT_FILENO);
+            close(nullFd);
+        }
+    }
+
+    ~StdoutSilencer() {
+        cout.flush();
+        if (savedFd >= 0) {
+            dup2(savedFd, STDOUT_FILENO);
+            close(savedFd);
+        }
+    }
+};
+
+// Helper function to time one detailed scan of 'dir' in milliseconds
+static double timeScan(const string& dir, WorkerPool* pool, size_t& entryCount,
+                       double& bytesPerEntry) {
+    DirSnapshot snapshot;
+    auto start = chrono::steady_clock::now();
+    DirectoryScanner::scan(dir, true, snapshot, pool);
+    snapshot.sortDirectoriesFirst();
+    auto end = chrono::steady_clock::now();
+    entryCount = snapshot.size();
+    bytesPerEntry = snapshot.bytesPerEntry();
+    return chrono::duration<double, milli>(end - start).count();
+}
+
+// Serial vs parallel detailed listing (scan and sort) on generated flat
+// directories, with the snapshot's memory per entry. Each mode runs
+// LISTING_RUNS times, in alternating order so neither always gets the
+// cache the other warmed, and reports its median. The directories are
+// removed afterwards unless 'keep' is set.
+static const int LISTING_RUNS = 5;
+
+static bool benchmarkListing(const string& baseDir, const vector<size_t>& sizes, unsigned threads, bool keep) {
+    WorkerPool pool(threads);
+    FileExplorer explorer;
+    cout << left << setw(10) << "Entries" << setw(14) << "Serial (ms)"
+         << setw(16) << "Parallel (ms)" << setw(10) << "Speedup" << "Bytes/entry" << endl;
+
+    for (size_t count : sizes) {
+        string dir = baseDir + "/flat_" + to_string(count);
+        if (!generateFlatDirectory(dir, count)) {
+            cout << RED << "Error: Cannot generate " << dir << RESET << endl;
+            if (!keep) {
+                StdoutSilencer silence;
+                explorer.deleteDirectoryRecursive(dir);
+            }
+            return false;
+        }
+        size_t serialCount = 0, parallelCount = 0;
+        double bytesPerEntry = 0;
+        vector<double> serialRuns, parallelRuns;
+        for (int run = 0; run < LISTING_RUNS; run++) {
+            if (run % 2 == 0) {
+                serialRuns.push_back(timeScan(dir, NULL, serialCount, bytesPerEntry));
+                parallelRuns.push_back(timeScan(dir, &pool, parallelCount, bytesPerEntry));
+            } else {
+                parallelRuns.push_back(timeScan(dir, &pool, parallelCount, bytesPerEntry));
+                serialRuns.push_back(timeScan(dir, NULL, serialCount, bytesPerEntry));
+            }
+        }
+        sort(serialRuns.begin(), serialRuns.end());
+        sort(parallelRuns.begin(), parallelRuns.end());
+        double serialMs = serialRuns[LISTING_RUNS / 2];
+        double parallelMs = parallelRuns[LISTING_RUNS / 2];
+
+        ostringstream speedup;
+        speedup << fixed << setprecision(2) << serialMs / parallelMs << "x";
+        cout << left << setw(10) << count << setw(14) << fixed << setprecision(1) << serialMs
+             << setw(16) << parallelMs << setw(10) << speedup.str() << bytesPerEntry << endl;
+        if (serialCount != parallelCount) {
+            cout << RED << "Error: entry counts differ (" << serialCount << " vs "
+                 << parallelCount << ")" << RESET << endl;
+        }
+        if (!keep) {
+            StdoutSilencer silence;
+            explorer.deleteDirectoryRecursive(dir);
+        }
+    }
+    return true;
+}
+
+// Case-insensitive substring matching: lowercased std::string copies (the
+// old approach) against each NameMatcher kernel, over random names
+static void benchmarkMatcher(size_t count) {
+    const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-";
+    vector<string> names(count);
+    unsigned seed = 12345;
+    for (auto& name : names) {
+        seed = seed * 1103515245 + 12345;
+        size_t length = 8 + (seed >> 16) % 33;
+        for (size_t i = 0; i < length; i++) {
+            seed = seed * 1103515245 + 12345;
+            name += alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+    }
+    const string needle = "Log";
+
+    cout << left << setw(12) << "Kernel" << setw(14) << "ns/name" << "Matches" << endl;
+
+    string loweredNeedle = needle;
+    transform(loweredNeedle.begin(), loweredNeedle.end(), loweredNeedle.begin(), ::tolower);
+    size_t baselineMatches = 0;
+    auto start = chrono::steady_clock::now();
+    for (const auto& name : names) {
+        string lowered = name;
+        transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+        if (lowered.find(loweredNeedle) != string::npos) baselineMatches++;
+    }
+    double baselineNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count;
+    cout << left << setw(12) << "tolower" << setw(14) << fixed << setprecision(2) << baselineNs
+         << baselineMatches << endl;
+
+    const char* kernels[] = {"scalar", "sse2", "avx2"};
+    for (const char* kernel : kernels) {
+        if (!NameMatcher::selectKernel(kernel)) {
+            cout << left << setw(12) << kernel << "unsupported on this CPU" << endl;
+            continue;
+        }
+        NameMatcher matcher(needle, NameMatcher::MATCH_SUBSTRING);
+        size_t matches = 0;
+        start = chrono::steady_clock::now();
+        for (const auto& name : names) {
+            if (matcher.matches(name.data(), name.size())) matches++;
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count;
+        cout << left << setw(12) << kernel << setw(14) << ns << matches
+             << (matches != baselineMatches ? "  MISMATCH" : "") << endl;
+    }
+}
+
+// Helper function to write 'size' bytes of reproducible content to 'path'
+static bool writeFile(const string& path, size_t size, unsigned seed) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    vector<char> data(size);
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = static_cast<char>('a' + (seed >> 16) % 26);
+    }
+    bool ok = write(fd, data.data(), size) == static_cast<ssize_t>(size);
+    return close(fd) == 0 && ok;
+}
+
+// Sizes of the synthetic trees; everything scales linearly with 'scale'
+struct TreeShape {
+    size_t wideFiles;       // one flat directory
+    size_t deepLevels;      // a chain of nested directories, one file each
+    size_t smallDirs;       // many small files spread over directories
+    size_t smallFilesPerDir;
+    size_t sparseFiles;     // huge sparse files with a few written blocks
+    off_t sparseSize;
+    size_t linkedFiles;     // hard-link farm: files with several names
+    size_t linksPerFile;
+    size_t longLineBytes;   // one file that is a single line (minified JS)
+
+    explicit TreeShape(double scale)
+        : wideFiles(static_cast<size_t>(50000 * scale)), deepLevels(static_cast<size_t>(500 * scale)),
+          smallDirs(static_cast<size_t>(100 * scale)), smallFilesPerDir(100), sparseFiles(4),
+          sparseSize(static_cast<off_t>(1024 * 1024 * 1024 * scale)),
+          linkedFiles(static_cast<size_t>(1000 * scale)), linksPerFile(4),
+          longLineBytes(max<size_t>(static_cast<size_t>(1024 * 1024 * scale), 200000)) {}
+};
+
+// Helper function to (re)create every synthetic tree below 'baseDir'.
+// Names and contents depend only on the shape, so runs are comparable.
+static bool generateTrees(const string& baseDir, const TreeShape& shape) {
+    if (!generateFlatDirectory(baseDir + "/wide", shape.wideFiles)) return false;
+
+    string path = baseDir + "/deep";
+    for (size_t level = 0; level < shape.deepLevels; level++) {
+        if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        if (!writeFile(path + "/file", 64, static_cast<unsigned>(level))) return false;
+        path += "/d";
+    }
+
+    string small = baseDir + "/small";
+    if (mkdir(small.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    for (size_t d = 0; d < shape.smallDirs; d++) {
+        string dir = small + "/dir" + to_string(d);
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        for (size_t f = 0; f < shape.smallFilesPerDir; f++) {
+            size_t size = 512 + (d * 7919 + f * 104729) % 3584;
+            string name = dir + "/file" + to_string(f) + (f % 10 == 0 ? ".log" : ".txt");
+            if (!writeFile(name, size, static_cast<unsigned>(d * shape.smallFilesPerDir + f))) return false;
+        }
+    }
+
+    string sparse = baseDir + "/sparse";
+    if (mkdir(sparse.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    for (size_t i = 0; i < shape.sparseFiles; i++) {
+        string name = sparse + "/huge" + to_string(i) + ".img";
+        int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        bool ok = ftruncate(fd, shape.sparseSize) == 0;
+        char block[4096];
+        memset(block, 'x', sizeof(block));
+        for (int part = 0; ok && part < 4; part++) {
+            ok = pwrite(fd, block, sizeof(block), shape.sparseSize / 4 * part) == static_cast<ssize_t>(sizeof(block));
+        }
+        if (close(fd) != 0 || !ok) return false;
+    }
+
+    string longLine = baseDir + "/longline";
+    if (mkdir(longLine.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    if (!writeFile(longLine + "/bundle.min.js", shape.longLineBytes, 1)) return false;
+
+    string links = baseDir + "/links";
+    if (mkdir(links.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    for (size_t i = 0; i < shape.linkedFiles; i++) {
+        string name = links + "/file" + to_string(i);
+        if (!writeFile(name, 4096, static_cast<unsigned>(i))) return false;
+        for (size_t l = 1; l < shape.linksPerFile; l++) {
+            string link = name + ".link" + to_string(l);
+            unlink(link.c_str());
+            if (link.empty() || ::link(name.c_str(), link.c_str()) != 0) return false;
+        }
+    }
+    return true;
+}
+
+// Counters sampled around every timed operation
+struct ProcessCounters {
+    unsigned long long readCalls;     // syscr in /proc/self/io
+    unsigned long long writeCalls;    // syscw
+    long rssKb;                       // VmRSS in /proc/self/status
+    long peakRssKb;                   // VmHWM, since the last resetPeakRss()
+
+    static ProcessCounters sample() {
+        ProcessCounters counters;
+        counters.readCalls = counters.writeCalls = 0;
+        counters.rssKb = counters.peakRssKb = 0;
+        ifstream io("/proc/self/io");
+        string key;
+        unsigned long long value;
+        while (io >> key >> value) {
+            if (key == "syscr:") counters.readCalls = value;
+            else if (key == "syscw:") counters.writeCalls = value;
+        }
+        ifstream status("/proc/self/status");
+        string line;
+        while (getline(status, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) counters.rssKb = atol(line.c_str() + 6);
+            else if (line.compare(0, 6, "VmHWM:") == 0) counters.peakRssKb = atol(line.c_str() + 6);
+        }
+        return counters;
+    }
+
+    // Restarts VmHWM at the current RSS (Linux 4.0+), so the next sample's
+    // peak belongs to what ran in between
+    static void resetPeakRss() {
+        ofstream clearRefs("/proc/self/clear_refs");
+        clearRefs << "5" << flush;
+    }
+};
+
+struct OperationResult {
+    string name;
+    vector<double> samplesMs;
+    unsigned long long readCalls;
+    unsigned long long writeCalls;
+    long rssDeltaKb;        // resident memory kept after the operation
+    long peakRssDeltaKb;    // highest resident memory above the start
+    uint64_t counters[COUNTER_COUNT];  // profiler counters of one extra run
+};
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = static_cast<size_t>(ceil(p / 100.0 * sorted.size()));
+    return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1];
+}
+
+// Runs 'operation' 'repeat' times; 'prepare' runs untimed before each
+// repetition (e.g. to recreate what the operation destroys). One more run
+// with the profiler on collects the getdents/stat/unlink/... counters, so
+// the timed runs pay nothing for them.
+static OperationResult timeOperation(const string& name, int repeat, const function<void()>& prepare,
+                                     const function<void()>& operation) {
+    OperationResult result;
+    result.name = name;
+    result.readCalls = result.writeCalls = 0;
+    result.rssDeltaKb = result.peakRssDeltaKb = 0;
+    for (int i = 0; i < repeat; i++) {
+        StdoutSilencer silence;
+        if (prepare) prepare();
+        ProcessCounters::resetPeakRss();
+        ProcessCounters before = ProcessCounters::sample();
+        auto start = chrono::steady_clock::now();
+        operation();
+        auto end = chrono::steady_clock::now();
+        ProcessCounters after = ProcessCounters::sample();
+        result.samplesMs.push_back(chrono::duration<double, milli>(end - start).count());
+        // Sampling itself costs a few reads; they are small next to the operations
+        result.readCalls += after.readCalls - before.readCalls;
+        result.writeCalls += after.writeCalls - before.writeCalls;
+        result.rssDeltaKb += after.rssKb - before.rssKb;
+        result.peakRssDeltaKb = max(result.peakRssDeltaKb, after.peakRssKb - before.rssKb);
+    }
+    result.readCalls /= max(repeat, 1);
+    result.writeCalls /= max(repeat, 1);
+    result.rssDeltaKb /= max(repeat, 1);
+    sort(result.samplesMs.begin(), result.samplesMs.end());
+
+    {
+        StdoutSilencer silence;
+        if (prepare) prepare();
+        Profiler& profiler = Profiler::instance();
+        profiler.reset();
+        profiler.setEnabled(true);
+        operation();
+        profiler.setEnabled(false);
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            result.counters[i] = profiler.counterValue(static_cast<ProfileCounter>(i));
+        }
+        profiler.reset();
+    }
+    return result;
+}
+
+// Helper function to turn a profiler counter name into a JSON key
+static string counterKey(ProfileCounter counter) {
+    string key = Profiler::counterName(counter);
+    for (char& c : key) {
+        c = isalnum(static_cast<unsigned char>(c)) ? static_cast<char>(tolower(c)) : '_';
+    }
+    return key;
+}
+
+// Helper function to remove the generated trees from 'baseDir'
+static void removeTrees(FileExplorer& explorer, const string& baseDir) {
+    const char* const trees[] = {"wide", "deep", "small", "sparse", "links", "longline"};
+    for (const char* tree : trees) {
+        string path = baseDir + "/" + tree;
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0) explorer.deleteDirectoryRecursive(path);
+    }
+}
+
+// Times the explorer's operations on the synthetic trees and writes the
+// results as JSON to 'json' (one object; latencies in milliseconds,
+// syscall counts per repetition). The trees are removed afterwards
+// unless 'keep' is set.
+static bool benchmarkOperations(const string& baseDir, int repeat, double scale, const string& moveDir,
+                                bool keep, ostream& json) {
+    TreeShape shape(scale);
+    auto generateStart = chrono::steady_clock::now();
+    if (!generateTrees(baseDir, shape)) {
+        cout << RED << "Error: Cannot generate trees in " << baseDir << ": " << strerror(errno) << RESET << endl;
+        if (!keep) {
+            FileExplorer explorer;
+            removeTrees(explorer, baseDir);
+        }
+        return false;
+    }
+    double generateSeconds = chrono::duration<double>(chrono::steady_clock::now() - generateStart).count();
+
+    FileExplorer explorer;
+    string scratch = baseDir + "/scratch";
+    string moveTarget = (moveDir.empty() ? baseDir : moveDir) + "/moved";
+    auto removeTree = [&explorer](const string& path) {
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0) explorer.deleteDirectoryRecursive(path);
+    };
+    vector<OperationResult> results;
+
+    {
+        StdoutSilencer silence;
+        explorer.changeDirectory(baseDir + "/wide");
+    }
+    results.push_back(timeOperation("list_wide_simple", repeat, nullptr, [&]() { explorer.listFiles(false); }));
+    results.push_back(timeOperation("list_wide_detailed", repeat, nullptr, [&]() { explorer.listFiles(true); }));
+    results.push_back(timeOperation("list_wide_top100_by_size", repeat, nullptr,
+                                    [&]() { explorer.listFilesWhere("sort=size reverse limit=100"); }));
+
+    results.push_back(timeOperation("search_small_names", repeat, nullptr,
+                                    [&]() { explorer.searchFiles("*.log", baseDir + "/small"); }));
+    results.push_back(timeOperation("search_deep_names", repeat, nullptr,
+                                    [&]() { explorer.searchFiles("file", baseDir + "/deep"); }));
+    results.push_back(timeOperation("search_small_contents", repeat, nullptr,
+                                    [&]() { explorer.searchContents("abc", baseDir + "/small", false); }));
+    // A regex over one very long line must not exhaust a worker's stack
+    results.push_back(timeOperation("search_long_line_regex", repeat, nullptr,
+                                    [&]() { explorer.searchContents("(a|b)+c", baseDir + "/longline", true); }));
+
+    results.push_back(timeOperation("copy_sparse_file", repeat,
+                                    [&]() { unlink((scratch + ".img").c_str()); },
+                                    [&]() { explorer.copyFileInternal(baseDir + "/sparse/huge0.img", scratch + ".img"); }));
+    unlink((scratch + ".img").c_str());
+
+    // copyFile/moveFile take sources relative to the current directory
+    {
+        StdoutSilencer silence;
+        explorer.changeDirectory(baseDir);
+    }
+    results.push_back(timeOperation("copy_small_tree", repeat, [&]() { removeTree(scratch); },
+                                    [&]() { explorer.copyFile("small", scratch); }));
+    results.push_back(timeOperation("du_links_cold", repeat, nullptr, [&]() {
+        DiskUsageScanner scanner;
+        scanner.measure(baseDir + "/links", NULL);
+    }));
+
+    // Destructive operations work on a fresh copy each time
+    results.push_back(timeOperation("delete_small_tree", repeat, [&]() {
+        removeTree(scratch);
+        explorer.copyFile("small", scratch);
+    }, [&]() { explorer.deleteDirectoryRecursive(scratch); }));
+    results.push_back(timeOperation("delete_deep_tree", repeat, [&]() {
+        removeTree(scratch);
+        explorer.copyFile("deep", scratch);
+    }, [&]() { explorer.deleteDirectoryRecursive(scratch); }));
+    results.push_back(timeOperation("move_small_tree", repeat, [&]() {
+        removeTree(scratch);
+        removeTree(moveTarget);
+        explorer.copyFile("small", scratch);
+    }, [&]() { explorer.moveFile("scratch", moveTarget); }));
+    removeTree(scratch);
+    removeTree(moveTarget);
+    if (!keep) removeTrees(explorer, baseDir);
+
+    string baseJson, moveJson;
+    appendJsonString(baseJson, baseDir);
+    appendJsonString(moveJson, moveDir.empty() ? baseDir : moveDir);
+    json << "{\n  \"base_dir\": " << baseJson << ",\n"
+         << "  \"move_dir\": " << moveJson << ",\n"
+         << "  \"repeat\": " << repeat << ",\n  \"scale\": " << scale << ",\n"
+         << "  \"hardware_threads\": " << thread::hardware_concurrency() << ",\n"
+         << "  \"trees\": {\"wide_files\": " << shape.wideFiles << ", \"deep_levels\": " << shape.deepLevels
+         << ", \"small_files\": " << shape.smallDirs * shape.smallFilesPerDir
+         << ", \"sparse_files\": " << shape.sparseFiles << ", \"sparse_bytes\": " << shape.sparseSize
+         << ", \"linked_files\": " << shape.linkedFiles << ", \"links_per_file\": " << shape.linksPerFile
+         << ", \"long_line_bytes\": " << shape.longLineBytes
+         << ", \"generate_seconds\": " << generateSeconds << "},\n"
+         << "  \"trees_kept\": " << (keep ? "true" : "false") << ",\n  \"operations\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const OperationResult& r = results[i];
+        double sum = 0;
+        for (double sample : r.samplesMs) sum += sample;
+        json << "    {\"name\": \"" << r.name << "\", \"samples\": " << r.samplesMs.size()
+             << ", \"p50_ms\": " << percentile(r.samplesMs, 50) << ", \"p99_ms\": " << percentile(r.samplesMs, 99)
+             << ", \"mean_ms\": " << (r.samplesMs.empty() ? 0 : sum / r.samplesMs.size())
+             << ", \"read_syscalls\": " << r.readCalls << ", \"write_syscalls\": " << r.writeCalls
+             << ", \"rss_delta_kb\": " << r.rssDeltaKb << ", \"peak_rss_delta_kb\": " << r.peakRssDeltaKb
+             << ", \"counters\": {";
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            json << (c > 0 ? ", " : "") << "\"" << counterKey(static_cast<ProfileCounter>(c)) << "\": "
+                 << r.counters[c];
+        }
+        json << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // Usage: file_explorer_bench [listing [--keep] [base-dir] [threads] [sizes...]]
+    //        file_explorer_bench matcher [names]
+    //        file_explorer_bench ops [--keep] [base-dir] [repeat] [scale] [move-dir] [json-file]
+    // With no arguments the listing and matcher suites run with their
+    // defaults; "ops" is run on its own since it writes gigabytes of
+    // (sparse) files. Both remove what they generate unless --keep is given.
+    string suite = argc > 1 ? argv[1] : "all";
+    bool keep = false;
+    vector<string> args;  // positional arguments after the suite
+    for (int i = 2; i < argc; i++) {
+        if (string(argv[i]) == "--keep") keep = true;
+        else args.push_back(argv[i]);
+    }
+    struct stat shm;
+    string defaultBase = stat("/dev/shm", &shm) == 0 ? "/dev/shm/file_explorer_bench" : "/tmp/file_explorer_bench";
+
+    if (suite == "ops") {
+        string baseDir = args.size() > 0 ? args[0] : defaultBase;
+        int repeat = args.size() > 1 ? max(1, atoi(args[1].c_str())) : 5;
+        double scale = args.size() > 2 ? atof(args[2].c_str()) : 1.0;
+        string moveDir = args.size() > 3 ? args[3] : "";
+        bool created = mkdir(baseDir.c_str(), 0755) == 0;
+        if (!created && errno != EEXIST) {
+            cout << RED << "Error: Cannot create " << baseDir << RESET << endl;
+            return 1;
+        }
+        bool ok;
+        if (args.size() > 4) {
+            ofstream json(args[4].c_str());
+            ok = benchmarkOperations(baseDir, repeat, scale, moveDir, keep, json);
+        } else {
+            ok = benchmarkOperations(baseDir, repeat, scale, moveDir, keep, cout);
+        }
+        if (created && !keep) rmdir(baseDir.c_str());
+        return ok ? 0 : 1;
+    }
+
+    if (suite == "matcher" || suite == "all") {
+        size_t count = (suite == "matcher" && !args.empty()) ? strtoull(args[0].c_str(), NULL, 10) : 1000000;
+        cout << BOLD << CYAN << "Name matching, " << count << " names" << RESET << endl;
+        benchmarkMatcher(count);
+    }
+    if (suite != "listing" && suite != "all") {
+        return 0;
+    }
+
+    // "all" takes no arguments; "listing" takes its own
+    bool listing = suite == "listing";
+    string baseDir = listing && args.size() > 0 ? args[0] : defaultBase;
+    unsigned threads = listing && args.size() > 1 ? static_cast<unsigned>(atoi(args[1].c_str())) : 16;
+    vector<size_t> sizes;
+    for (size_t i = 2; listing && i < args.size(); i++) {
+        sizes.push_back(strtoull(args[i].c_str(), NULL, 10));
+    }
+    if (sizes.empty()) {
+        sizes = {10000, 100000, 1000000};
+    }
+
+    bool created = mkdir(baseDir.c_str(), 0755) == 0;
+    if (!created && errno != EEXIST) {
+        cout << RED << "Error: Cannot create " << baseDir << RESET << endl;
+        return 1;
+    }
+    cout << BOLD << CYAN << "Detailed listing, " << threads << " threads, median of " << LISTING_RUNS
+         << " runs, in " << baseDir << RESET << endl;
+    bool ok = benchmarkListing(baseDir, sizes, threads, keep);
+    if (created && !keep) rmdir(baseDir.c_str());
+    return ok ? 0 : 1;
+}